@@ -0,0 +1,102 @@
+//! Benchmarks for the individual compilation phases.
+//!
+//! Each phase (lexing, parsing, codegen) is measured on its own against synthetic programs of a
+//! few sizes, so a change to one phase shows up in that phase's numbers instead of being smeared
+//! across the whole pipeline. Lexing throughput is reported in tokens per second and the later
+//! phases in AST nodes per second (criterion's "elements"), which makes runs comparable even when
+//! the synthetic inputs change shape.
+
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+use std::hint::black_box;
+
+/// Generate a synthetic program whose single return expression has `terms` operands.
+///
+/// The expression cycles through every binary operator and sprinkles in unary operators and
+/// parenthesized groups, so all of the parser's precedence levels and all of codegen's operator
+/// paths get exercised, not just a long chain of additions.
+fn generate_program(terms: usize) -> String {
+    let mut source = String::from("int main(void) {\n    return 1");
+
+    for i in 0..terms {
+        let value = (i % 100) + 1;
+        match i % 6 {
+            0 => source.push_str(&format!(" + {value}")),
+            1 => source.push_str(&format!(" - {value}")),
+            2 => source.push_str(&format!(" * {value}")),
+            3 => source.push_str(&format!(" / {value}")),
+            4 => source.push_str(&format!(" % ({value} + 1)")),
+            _ => source.push_str(&format!(" + ~{value}")),
+        }
+    }
+
+    source.push_str(";\n}\n");
+    source
+}
+
+/// The sizes (in expression terms) benchmarked for every phase.
+const SIZES: [(&str, usize); 3] = [("small", 100), ("medium", 10_000), ("large", 500_000)];
+
+fn bench_lexer(c: &mut Criterion) {
+    let mut group = c.benchmark_group("lexer");
+
+    for (name, terms) in SIZES {
+        let source = generate_program(terms);
+        let token_count = ecc::lexer::tokenize(&source).len() as u64;
+
+        group.throughput(Throughput::Elements(token_count));
+        group.bench_with_input(BenchmarkId::new("tokenize", name), &source, |b, source| {
+            b.iter(|| ecc::lexer::tokenize(black_box(source)))
+        });
+    }
+
+    group.finish();
+}
+
+fn bench_parser(c: &mut Criterion) {
+    let mut group = c.benchmark_group("parser");
+
+    for (name, terms) in SIZES {
+        let source = generate_program(terms);
+        let tokens = ecc::lexer::tokenize(&source);
+        let program = ecc::parser::parse_token_stream(&source, tokens.iter().copied()).unwrap();
+
+        group.throughput(Throughput::Elements(program.exprs.len() as u64));
+        group.bench_with_input(
+            BenchmarkId::new("parse_token_stream", name),
+            &source,
+            |b, source| {
+                b.iter(|| {
+                    ecc::parser::parse_token_stream(
+                        black_box(source),
+                        tokens.iter().copied(),
+                    )
+                    .unwrap()
+                })
+            },
+        );
+    }
+
+    group.finish();
+}
+
+fn bench_compiler(c: &mut Criterion) {
+    let mut group = c.benchmark_group("compiler");
+
+    for (name, terms) in SIZES {
+        let source = generate_program(terms);
+        let tokens = ecc::lexer::Lexer::new(&source);
+        let program = ecc::parser::parse_token_stream(&source, tokens).unwrap();
+
+        group.throughput(Throughput::Elements(program.exprs.len() as u64));
+        group.bench_with_input(
+            BenchmarkId::new("compile_ast", name),
+            &program,
+            |b, program| b.iter(|| ecc::compiler::compile_ast(black_box(program.clone()))),
+        );
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_lexer, bench_parser, bench_compiler);
+criterion_main!(benches);
@@ -1,12 +1,23 @@
+use crate::intern::{Interner, Symbol};
+
 /// A program.
 ///
-/// This node represents a C program. For now, a program consists of a single function declaration.
-/// It can technically be called whatever, but if the name of the function is not `main`, the
-/// linker will yell at you.
+/// This node represents a C program: a sequence of function declarations in source order. If none
+/// of them is called `main`, the linker will yell at you.
+///
+/// The program also owns the [`ExprPool`] that every expression in the tree lives in, and the
+/// [`Interner`] behind every [`Symbol`] in it. Keeping both on the program means the whole tree
+/// travels as one unit from the parser to the compiler.
 #[derive(Clone, Debug)]
 pub struct Program {
-    /// The single function of the program.
-    pub function: Function,
+    /// The functions of the program, in source order.
+    pub functions: Vec<Function>,
+
+    /// The pool holding every expression in the program.
+    pub exprs: ExprPool,
+
+    /// The interner holding the text of every identifier in the program.
+    pub symbols: Interner,
 }
 
 /// A function node.
@@ -17,8 +28,8 @@ pub struct Program {
 /// error if there is no `main` function defined.
 #[derive(Clone, Debug)]
 pub struct Function {
-    /// The function's name.
-    pub name: String,
+    /// The function's name, interned in the program's [`Interner`].
+    pub name: Symbol,
 
     /// The body of the function.
     pub body: Vec<Statement>,
@@ -41,26 +52,91 @@ pub enum BinaryOp {
     Mod,
 }
 
+/// A handle to an expression stored in an [`ExprPool`].
+///
+/// Expression nodes refer to their children through these compact indices instead of owning them
+/// through a `Box`. An id is only meaningful together with the pool it came from.
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub struct ExprId(u32);
+
+impl ExprId {
+    /// Create an id from a raw index into a pool.
+    pub fn from_index(index: usize) -> Self {
+        Self(index as u32)
+    }
+
+    /// The raw index of this id into the pool it came from.
+    pub fn index(self) -> usize {
+        self.0 as usize
+    }
+}
+
+/// A flat arena of expressions.
+///
+/// All of the expressions in a program are stored contiguously in this pool and refer to each
+/// other by [`ExprId`]. Compared to boxing every child, this keeps a deep expression tree in one
+/// dense allocation that the compiler can walk with friendly, mostly-sequential memory access, and
+/// dropping the pool frees the whole tree in one shot instead of recursing through it node by
+/// node.
+#[derive(Clone, Debug, Default)]
+pub struct ExprPool {
+    exprs: Vec<Expr>,
+}
+
+impl ExprPool {
+    /// Create an empty expression pool.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Store an expression in the pool and return its id.
+    ///
+    /// Children are pushed before their parents, so the pool naturally ends up in post order.
+    pub fn push(&mut self, expr: Expr) -> ExprId {
+        let id = ExprId(self.exprs.len() as u32);
+        self.exprs.push(expr);
+        id
+    }
+
+    /// Look up an expression by its id.
+    pub fn get(&self, id: ExprId) -> Expr {
+        self.exprs[id.0 as usize]
+    }
+
+    /// Replace the expression stored at the given id.
+    pub fn set(&mut self, id: ExprId, expr: Expr) {
+        self.exprs[id.0 as usize] = expr;
+    }
+
+    /// Return the number of expressions stored in the pool.
+    pub fn len(&self) -> usize {
+        self.exprs.len()
+    }
+
+    /// Return true if the pool holds no expressions.
+    pub fn is_empty(&self) -> bool {
+        self.exprs.is_empty()
+    }
+}
+
 /// An expression.
 ///
 /// Expressions are any part of the source code which can evaluate to a value. For example,
-/// literals like integers, floating point numbers, or strings.
-#[derive(Clone, Debug)]
+/// literals like integers, floating point numbers, or strings. Child expressions are referenced by
+/// [`ExprId`] into the program's [`ExprPool`], which keeps this enum small and `Copy`.
+#[derive(Clone, Copy, Debug)]
 pub enum Expr {
     /// An integer literal.
     Integer(i32),
 
     /// A unary expression.
-    Unary {
-        operator: UnaryOp,
-        operand: Box<Expr>,
-    },
+    Unary { operator: UnaryOp, operand: ExprId },
 
     /// A binary expression.
     Binary {
         operator: BinaryOp,
-        left: Box<Expr>,
-        right: Box<Expr>,
+        left: ExprId,
+        right: ExprId,
     },
 }
 
@@ -70,5 +146,5 @@ pub enum Expr {
 #[derive(Clone, Debug)]
 pub enum Statement {
     /// A return statement.
-    Return(Expr),
+    Return(ExprId),
 }
@@ -0,0 +1,305 @@
+//! Binary serialization of a parsed [`ast::Program`].
+//!
+//! The front end's output is often wanted more than once - codegen now, analysis tooling or IR
+//! passes later - and re-running `tokenize` and `parse_token_stream` to get it is pure waste. The
+//! tree is already flat in memory: expressions live in an [`ast::ExprPool`] addressed by dense
+//! `u32` ids and names are interned `u32` symbols, so the file format is little more than those
+//! arrays written out verbatim. Loading walks each fixed-width record array once with no parsing,
+//! no lookahead, and no per-node work beyond rebuilding the enum tags, which on a big file is
+//! microseconds against the milliseconds the front end takes.
+//!
+//! Records are little-endian `u32` words throughout. The layout is a fixed header (magic,
+//! version, section counts) followed by the symbol table (string ends plus one text blob), the
+//! expression records at sixteen bytes each, the statement records, and the function records.
+//! Everything is offset-based, so a reader can slice a section straight out of a memory-mapped
+//! file. The version is bumped whenever the AST changes shape; a stale file is rejected rather
+//! than misread, the same contract the object cache gets from its hash salt.
+
+use crate::ast;
+use crate::intern::Symbol;
+
+/// The magic bytes opening every AST file.
+const MAGIC: [u8; 4] = *b"ECCA";
+
+/// The format version; bump on any change to the record layouts.
+const VERSION: u32 = 1;
+
+/// Why an AST file could not be loaded.
+#[derive(Debug)]
+pub enum FormatError {
+    /// The file does not start with the AST file magic.
+    BadMagic,
+
+    /// The file was written by a different format version.
+    WrongVersion(u32),
+
+    /// The file ends before its sections do, or a record points outside its section.
+    Malformed,
+}
+
+impl std::fmt::Display for FormatError {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            Self::BadMagic => write!(f, "not an ecc AST file"),
+            Self::WrongVersion(version) => {
+                write!(f, "AST file version {version}, expected {VERSION}")
+            }
+            Self::Malformed => write!(f, "malformed AST file"),
+        }
+    }
+}
+
+/// Serialize a program into the flat binary format.
+pub fn serialize(program: &ast::Program) -> Vec<u8> {
+    let mut out = Vec::new();
+
+    out.extend_from_slice(&MAGIC);
+    push_u32(&mut out, VERSION);
+    push_u32(&mut out, program.symbols.len() as u32);
+    push_u32(&mut out, program.exprs.len() as u32);
+    push_u32(&mut out, program.functions.len() as u32);
+
+    let statement_count: usize = program
+        .functions
+        .iter()
+        .map(|function| function.body.len())
+        .sum();
+    push_u32(&mut out, statement_count as u32);
+
+    // Symbol table: the end offset of each string into the blob, then the blob itself. Starts
+    // are the previous string's end, so one word per symbol suffices.
+    let mut blob = Vec::new();
+    for index in 0..program.symbols.len() {
+        blob.extend_from_slice(program.symbols.resolve(Symbol::from_index(index)).as_bytes());
+        push_u32(&mut out, blob.len() as u32);
+    }
+    push_u32(&mut out, blob.len() as u32);
+    out.extend_from_slice(&blob);
+
+    // Expressions: four words each, in pool order, so ids in the file are the pool indices.
+    for index in 0..program.exprs.len() {
+        let (tag, a, b, c) = match program.exprs.get(ast::ExprId::from_index(index)) {
+            ast::Expr::Integer(value) => (0, value as u32, 0, 0),
+            ast::Expr::Unary { operator, operand } => {
+                (1, unary_op_tag(operator), operand.index() as u32, 0)
+            }
+            ast::Expr::Binary {
+                operator,
+                left,
+                right,
+            } => (
+                2,
+                binary_op_tag(operator),
+                left.index() as u32,
+                right.index() as u32,
+            ),
+        };
+
+        push_u32(&mut out, tag);
+        push_u32(&mut out, a);
+        push_u32(&mut out, b);
+        push_u32(&mut out, c);
+    }
+
+    // Statements for all functions back to back, then the functions pointing into them.
+    for function in &program.functions {
+        for statement in &function.body {
+            match statement {
+                ast::Statement::Return(expr) => {
+                    push_u32(&mut out, 0);
+                    push_u32(&mut out, expr.index() as u32);
+                }
+            }
+        }
+    }
+
+    let mut statement_start = 0;
+    for function in &program.functions {
+        push_u32(&mut out, function.name.index() as u32);
+        push_u32(&mut out, statement_start);
+        push_u32(&mut out, function.body.len() as u32);
+        statement_start += function.body.len() as u32;
+    }
+
+    out
+}
+
+/// Load a program back out of the flat binary format.
+///
+/// The input can be (and from the driver is) a memory-mapped file. Each section is decoded in
+/// one forward walk over its fixed-width records; every id is bounds-checked against the section
+/// it points into, so a truncated or corrupted file comes back as a [`FormatError`] instead of a
+/// panic deep inside codegen.
+pub fn deserialize(bytes: &[u8]) -> Result<ast::Program, FormatError> {
+    let mut cursor = Cursor { bytes, offset: 0 };
+
+    if cursor.take(4)? != MAGIC {
+        return Err(FormatError::BadMagic);
+    }
+
+    let version = cursor.u32()?;
+    if version != VERSION {
+        return Err(FormatError::WrongVersion(version));
+    }
+
+    let symbol_count = cursor.u32()? as usize;
+    let expr_count = cursor.u32()? as usize;
+    let function_count = cursor.u32()? as usize;
+    let statement_count = cursor.u32()? as usize;
+
+    let mut symbols = crate::intern::Interner::new();
+    let mut ends = Vec::with_capacity(symbol_count);
+    for _ in 0..symbol_count {
+        ends.push(cursor.u32()? as usize);
+    }
+
+    let blob_len = cursor.u32()? as usize;
+    let blob = cursor.take(blob_len)?;
+    let mut start = 0;
+    for end in ends {
+        let text = blob.get(start..end).ok_or(FormatError::Malformed)?;
+        let text = str::from_utf8(text).map_err(|_| FormatError::Malformed)?;
+        symbols.intern(text);
+        start = end;
+    }
+
+    let mut exprs = ast::ExprPool::new();
+    for _ in 0..expr_count {
+        let tag = cursor.u32()?;
+        let a = cursor.u32()?;
+        let b = cursor.u32()?;
+        let c = cursor.u32()?;
+
+        let expr = match tag {
+            0 => ast::Expr::Integer(a as i32),
+            1 => ast::Expr::Unary {
+                operator: unary_op_from_tag(a)?,
+                operand: expr_id(b, exprs.len())?,
+            },
+            2 => ast::Expr::Binary {
+                operator: binary_op_from_tag(a)?,
+                left: expr_id(b, exprs.len())?,
+                right: expr_id(c, exprs.len())?,
+            },
+            _ => return Err(FormatError::Malformed),
+        };
+
+        exprs.push(expr);
+    }
+
+    let mut statements = Vec::with_capacity(statement_count);
+    for _ in 0..statement_count {
+        let tag = cursor.u32()?;
+        let expr = cursor.u32()?;
+        if tag != 0 {
+            return Err(FormatError::Malformed);
+        }
+
+        statements.push(ast::Statement::Return(expr_id(expr, exprs.len())?));
+    }
+
+    let mut functions = Vec::with_capacity(function_count);
+    for _ in 0..function_count {
+        let name = cursor.u32()? as usize;
+        let start = cursor.u32()? as usize;
+        let count = cursor.u32()? as usize;
+
+        if name >= symbols.len() {
+            return Err(FormatError::Malformed);
+        }
+
+        let body = statements
+            .get(start..start + count)
+            .ok_or(FormatError::Malformed)?;
+
+        functions.push(ast::Function {
+            name: Symbol::from_index(name),
+            body: body.to_vec(),
+        });
+    }
+
+    Ok(ast::Program {
+        functions,
+        exprs,
+        symbols,
+    })
+}
+
+/// A bounds-checked reading position in the file bytes.
+struct Cursor<'a> {
+    bytes: &'a [u8],
+    offset: usize,
+}
+
+impl<'a> Cursor<'a> {
+    /// Take the next `count` bytes.
+    fn take(&mut self, count: usize) -> Result<&'a [u8], FormatError> {
+        let taken = self
+            .bytes
+            .get(self.offset..self.offset + count)
+            .ok_or(FormatError::Malformed)?;
+
+        self.offset += count;
+        Ok(taken)
+    }
+
+    /// Take the next little-endian word.
+    fn u32(&mut self) -> Result<u32, FormatError> {
+        Ok(u32::from_le_bytes(self.take(4)?.try_into().unwrap()))
+    }
+}
+
+/// Check that an expression id from the file points at an already-decoded expression.
+///
+/// The pool is post-ordered (operands precede their operators), so a valid file only ever refers
+/// backwards; enforcing that here also rules out reference cycles.
+fn expr_id(index: u32, decoded: usize) -> Result<ast::ExprId, FormatError> {
+    if (index as usize) < decoded {
+        Ok(ast::ExprId::from_index(index as usize))
+    } else {
+        Err(FormatError::Malformed)
+    }
+}
+
+/// Append a little-endian word.
+fn push_u32(out: &mut Vec<u8>, value: u32) {
+    out.extend_from_slice(&value.to_le_bytes());
+}
+
+fn unary_op_tag(op: ast::UnaryOp) -> u32 {
+    match op {
+        ast::UnaryOp::Compliment => 0,
+        ast::UnaryOp::NegateArith => 1,
+        ast::UnaryOp::NegateLogical => 2,
+    }
+}
+
+fn unary_op_from_tag(tag: u32) -> Result<ast::UnaryOp, FormatError> {
+    match tag {
+        0 => Ok(ast::UnaryOp::Compliment),
+        1 => Ok(ast::UnaryOp::NegateArith),
+        2 => Ok(ast::UnaryOp::NegateLogical),
+        _ => Err(FormatError::Malformed),
+    }
+}
+
+fn binary_op_tag(op: ast::BinaryOp) -> u32 {
+    match op {
+        ast::BinaryOp::Plus => 0,
+        ast::BinaryOp::Minus => 1,
+        ast::BinaryOp::Times => 2,
+        ast::BinaryOp::Divide => 3,
+        ast::BinaryOp::Mod => 4,
+    }
+}
+
+fn binary_op_from_tag(tag: u32) -> Result<ast::BinaryOp, FormatError> {
+    match tag {
+        0 => Ok(ast::BinaryOp::Plus),
+        1 => Ok(ast::BinaryOp::Minus),
+        2 => Ok(ast::BinaryOp::Times),
+        3 => Ok(ast::BinaryOp::Divide),
+        4 => Ok(ast::BinaryOp::Mod),
+        _ => Err(FormatError::Malformed),
+    }
+}
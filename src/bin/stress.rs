@@ -0,0 +1,279 @@
+//! Whole-pipeline throughput harness over a synthetic stress corpus.
+//!
+//! The criterion benches time each phase in isolation, which is exactly what hides a regression
+//! in how the phases compose (an extra buffering step between lexer and parser costs nothing in
+//! either phase's own numbers). This tool synthesizes a few adversarially shaped programs at a
+//! configurable scale, pushes each through the full `compile_source` pipeline, and reports
+//! end-to-end megabytes per second plus peak resident set size per corpus.
+//!
+//! Numbers can be recorded to a baseline file and later runs checked against it, so a merge can
+//! be gated on whole-pipeline throughput:
+//!
+//! ```text
+//! $ cargo run --release --bin stress -- --record baseline.txt
+//! $ cargo run --release --bin stress -- --check baseline.txt
+//! ```
+//!
+//! Baselines are machine-specific and belong on the machine that measures, not in the repo. A
+//! check fails (exit code 1) when a corpus loses more than 10% throughput or gains more than 20%
+//! peak memory against its recorded numbers.
+
+use std::collections::HashMap;
+use std::fmt::Write as _;
+use std::path::Path;
+use std::time::Instant;
+
+fn main() {
+    let mut args = std::env::args();
+    let program_name = args.next().unwrap();
+
+    let mut scale = 1;
+    let mut record: Option<String> = None;
+    let mut check: Option<String> = None;
+
+    while let Some(arg) = args.next() {
+        if arg == "--scale" {
+            let Some(value) = args.next().and_then(|v| v.parse().ok()) else {
+                eprintln!("{program_name}: '--scale' expects a number");
+                std::process::exit(1);
+            };
+
+            scale = value;
+        } else if arg == "--record" {
+            record = args.next();
+        } else if arg == "--check" {
+            check = args.next();
+        } else {
+            eprintln!("{program_name}: unknown argument '{arg}'");
+            std::process::exit(1);
+        }
+    }
+
+    let corpora = build_corpora(scale);
+    let mut results = Vec::new();
+
+    println!("{: <12} {: >10} {: >12} {: >12}", "corpus", "size", "MB/s", "peak RSS");
+    for corpus in &corpora {
+        let result = measure(corpus);
+        println!(
+            "{: <12} {: >10} {: >12.1} {: >9} kB",
+            corpus.name,
+            format!("{} B", corpus.source.len()),
+            result.mb_per_s,
+            result.peak_rss_kb
+        );
+
+        results.push(result);
+    }
+
+    if let Some(path) = record {
+        write_baseline(Path::new(&path), &results);
+        println!("recorded baseline to {path}");
+    }
+
+    if let Some(path) = check
+        && !check_baseline(Path::new(&path), &results)
+    {
+        std::process::exit(1);
+    }
+}
+
+/// One synthetic program in the corpus.
+struct Corpus {
+    name: &'static str,
+    source: String,
+}
+
+/// One corpus measured end to end.
+struct Measurement {
+    name: &'static str,
+    mb_per_s: f64,
+    peak_rss_kb: u64,
+}
+
+/// Build the corpus set, sized by the scale factor.
+///
+/// The shapes each lean on a different part of the pipeline: `deep` is one expression nested in
+/// thousands of parentheses (group parsing and the explicit operator stack), `wide` is thousands
+/// of small functions (per-function codegen fan-out and symbol handling), and `chains` is a long
+/// flat expression cycling through every precedence level (the shift/reduce loop and every
+/// operator's selection path).
+fn build_corpora(scale: usize) -> Vec<Corpus> {
+    vec![
+        Corpus {
+            name: "deep",
+            source: generate_deep(10_000 * scale),
+        },
+        Corpus {
+            name: "wide",
+            source: generate_wide(20_000 * scale),
+        },
+        Corpus {
+            name: "chains",
+            source: generate_chains(200_000 * scale),
+        },
+    ]
+}
+
+/// A single return expression wrapped in `depth` parentheses.
+fn generate_deep(depth: usize) -> String {
+    let mut source = String::from("int main(void) {\n    return ");
+    source.extend(std::iter::repeat_n('(', depth));
+    source.push_str("1 + 1");
+    source.extend(std::iter::repeat_n(')', depth));
+    source.push_str(";\n}\n");
+    source
+}
+
+/// Many small functions, each with a distinct name and literal table.
+fn generate_wide(functions: usize) -> String {
+    let mut source = String::new();
+    for i in 0..functions {
+        let _ = write!(
+            source,
+            "int f{i}(void) {{\n    return {} + {} * {};\n}}\n",
+            i % 1000,
+            (i * 7) % 1000,
+            (i * 13) % 100 + 1
+        );
+    }
+
+    source.push_str("int main(void) {\n    return 0;\n}\n");
+    source
+}
+
+/// One long operator chain cycling through every precedence level.
+fn generate_chains(terms: usize) -> String {
+    let mut source = String::from("int main(void) {\n    return 1");
+    for i in 0..terms {
+        let value = (i % 100) + 1;
+        let _ = match i % 6 {
+            0 => write!(source, " + {value}"),
+            1 => write!(source, " - {value}"),
+            2 => write!(source, " * {value}"),
+            3 => write!(source, " / {value}"),
+            4 => write!(source, " % ({value} + 1)"),
+            _ => write!(source, " + ~{value}"),
+        };
+    }
+
+    source.push_str(";\n}\n");
+    source
+}
+
+/// Run one corpus through the whole pipeline and take its numbers.
+///
+/// The best of three runs is kept, which is enough to shake out a cold cache without turning the
+/// harness into a statistics project; peak RSS is reset before each corpus (Linux exposes that
+/// through `clear_refs`) so each one reports its own high-water mark rather than the largest
+/// corpus that ran before it.
+fn measure(corpus: &Corpus) -> Measurement {
+    reset_peak_rss();
+
+    let mut best = f64::INFINITY;
+    for _ in 0..3 {
+        let start = Instant::now();
+        let assembly = ecc::try_compile_source(&corpus.source).unwrap_or_else(|error| {
+            eprintln!("corpus '{}' failed to compile: {error}", corpus.name);
+            std::process::exit(1);
+        });
+
+        let elapsed = start.elapsed().as_secs_f64();
+        std::hint::black_box(assembly);
+        best = best.min(elapsed);
+    }
+
+    Measurement {
+        name: corpus.name,
+        mb_per_s: corpus.source.len() as f64 / best / 1_000_000.0,
+        peak_rss_kb: peak_rss_kb(),
+    }
+}
+
+/// Reset the process peak RSS counter, where the kernel allows it.
+fn reset_peak_rss() {
+    let _ = std::fs::write("/proc/self/clear_refs", "5");
+}
+
+/// The process peak RSS in kilobytes, from `VmHWM` in `/proc/self/status`.
+fn peak_rss_kb() -> u64 {
+    let Ok(status) = std::fs::read_to_string("/proc/self/status") else {
+        return 0;
+    };
+
+    status
+        .lines()
+        .find_map(|line| line.strip_prefix("VmHWM:"))
+        .and_then(|rest| rest.trim().strip_suffix("kB"))
+        .and_then(|kb| kb.trim().parse().ok())
+        .unwrap_or(0)
+}
+
+/// Write the measurements out as a baseline file, one corpus per line.
+fn write_baseline(path: &Path, results: &[Measurement]) {
+    let mut contents = String::new();
+    for result in results {
+        let _ = writeln!(
+            contents,
+            "{} {:.1} {}",
+            result.name, result.mb_per_s, result.peak_rss_kb
+        );
+    }
+
+    if let Err(error) = std::fs::write(path, contents) {
+        eprintln!("could not write baseline: {error}");
+        std::process::exit(1);
+    }
+}
+
+/// Compare the measurements against a recorded baseline, returning false on a regression.
+fn check_baseline(path: &Path, results: &[Measurement]) -> bool {
+    let contents = match std::fs::read_to_string(path) {
+        Ok(contents) => contents,
+        Err(error) => {
+            eprintln!("could not read baseline: {error}");
+            return false;
+        }
+    };
+
+    let baseline: HashMap<&str, (f64, u64)> = contents
+        .lines()
+        .filter_map(|line| {
+            let mut fields = line.split_whitespace();
+            let name = fields.next()?;
+            let mb_per_s = fields.next()?.parse().ok()?;
+            let rss = fields.next()?.parse().ok()?;
+            Some((name, (mb_per_s, rss)))
+        })
+        .collect();
+
+    let mut ok = true;
+    for result in results {
+        let Some(&(base_mb_per_s, base_rss)) = baseline.get(result.name) else {
+            eprintln!("{}: not in baseline, skipping", result.name);
+            continue;
+        };
+
+        if result.mb_per_s < base_mb_per_s * 0.9 {
+            eprintln!(
+                "{}: throughput regressed {:.1} -> {:.1} MB/s",
+                result.name, base_mb_per_s, result.mb_per_s
+            );
+            ok = false;
+        }
+
+        if result.peak_rss_kb as f64 > base_rss as f64 * 1.2 {
+            eprintln!(
+                "{}: peak RSS regressed {} -> {} kB",
+                result.name, base_rss, result.peak_rss_kb
+            );
+            ok = false;
+        }
+    }
+
+    if ok {
+        println!("all corpora within baseline");
+    }
+
+    ok
+}
@@ -1,6 +1,14 @@
 use std::fmt::Write;
 
 use crate::ast;
+use crate::intern::Interner;
+use crate::ir;
+
+macro_rules! writeln_unwrap {
+    ($dst:expr, $($arg:tt)*) => {
+        writeln!($dst, $($arg)*).unwrap()
+    }
+}
 
 /// Compile a program to assembly.
 ///
@@ -8,161 +16,950 @@ use crate::ast;
 /// abstract syntax tree. For now, it is guaranteed to link properly if the source code contains a
 /// `main` function.
 pub fn compile_ast(program: ast::Program) -> String {
+    compile_ir(&ir::lower_program(&program))
+}
+
+/// Compile a three-address IR program to assembly.
+///
+/// This is the back half of [`compile_ast`]: anything that already has IR in hand (an
+/// optimization pass pipeline, say) can come in here directly.
+pub fn compile_ir(program: &ir::Program) -> String {
+    serialize(&compile_functions(program))
+}
+
+/// Compile a program straight to the bytes of an ELF relocatable object.
+///
+/// This skips the textual assembly round trip entirely: the selected instructions are encoded to
+/// machine code by [`crate::elf`] and come back as a `.o` ready to hand to the linker.
+pub fn compile_ast_object(program: ast::Program) -> Vec<u8> {
+    compile_ir_object(&ir::lower_program(&program))
+}
+
+/// Compile a three-address IR program straight to an ELF relocatable object.
+pub fn compile_ir_object(program: &ir::Program) -> Vec<u8> {
+    crate::elf::write_object(&compile_functions(program))
+}
+
+/// Serialize an instruction list into assembly text.
+fn serialize(instructions: &[Instruction]) -> String {
+    let mut assembly = String::new();
+
+    for instruction in instructions {
+        writeln_unwrap!(assembly, "{instruction}");
+    }
+
+    assembly
+}
+
+/// Select instructions for every function in the program, in source order.
+///
+/// Function bodies are completely independent at this point, so with more than one of them the
+/// work fans out across a thread pool in the same claim-by-atomic-index style the driver uses for
+/// whole files. Each worker emits into the claimed function's own buffer, and the buffers are
+/// concatenated in source order afterwards, so the output is byte-identical to a serial compile.
+/// A single-function program takes the plain serial path and pays no thread overhead.
+fn compile_functions(program: &ir::Program) -> Vec<Instruction> {
+    use std::sync::Mutex;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+
+    if let [function] = program.functions.as_slice() {
+        return compile_function(function, &program.symbols);
+    }
+
+    let buffers: Vec<Mutex<Vec<Instruction>>> = program
+        .functions
+        .iter()
+        .map(|_| Mutex::new(Vec::new()))
+        .collect();
+
+    let worker_count = std::thread::available_parallelism()
+        .map(|n| n.get())
+        .unwrap_or(1)
+        .min(program.functions.len());
+
+    let next_function = AtomicUsize::new(0);
+
+    std::thread::scope(|scope| {
+        for _ in 0..worker_count {
+            scope.spawn(|| {
+                loop {
+                    let index = next_function.fetch_add(1, Ordering::Relaxed);
+                    let Some(function) = program.functions.get(index) else {
+                        break;
+                    };
+
+                    *buffers[index].lock().unwrap() = compile_function(function, &program.symbols);
+                }
+            });
+        }
+    });
+
+    buffers
+        .into_iter()
+        .flat_map(|buffer| buffer.into_inner().unwrap())
+        .collect()
+}
+
+/// Select instructions for a single function.
+fn compile_function(function: &ir::Function, symbols: &Interner) -> Vec<Instruction> {
     let mut compiler = Compiler::new();
-    compiler.compile_program(program);
-    compiler.finish()
+    compiler.compile_function(function, symbols);
+    compiler.instructions
 }
 
-macro_rules! writeln_unwrap {
-    ($dst:expr, $($arg:tt)*) => {
-        writeln!($dst, $($arg)*).unwrap()
+/// A register that generated code can use.
+///
+/// The names refer to the 32-bit views (`%eax` and friends), since all of our arithmetic is on
+/// 32-bit integers. Push and pop use the corresponding 64-bit views because the stack always moves
+/// in 8-byte steps. Only caller-saved registers are listed, so generated code never has to worry
+/// about preserving anything for its own caller.
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub enum Reg {
+    Eax,
+    Ecx,
+    Edx,
+    Esi,
+    Edi,
+    R8d,
+    R9d,
+    R10d,
+    R11d,
+}
+
+/// The registers temporaries may live in, in allocation order.
+///
+/// `eax` comes first so that the common case (a whole expression fitting in one register) computes
+/// straight into the return-value register with no final move.
+const SCRATCH_REGS: [Reg; 9] = [
+    Reg::Eax,
+    Reg::Ecx,
+    Reg::Edx,
+    Reg::Esi,
+    Reg::Edi,
+    Reg::R8d,
+    Reg::R9d,
+    Reg::R10d,
+    Reg::R11d,
+];
+
+impl Reg {
+    /// The name of the 32-bit view of this register, e.g. `eax`.
+    fn name32(self) -> &'static str {
+        match self {
+            Self::Eax => "eax",
+            Self::Ecx => "ecx",
+            Self::Edx => "edx",
+            Self::Esi => "esi",
+            Self::Edi => "edi",
+            Self::R8d => "r8d",
+            Self::R9d => "r9d",
+            Self::R10d => "r10d",
+            Self::R11d => "r11d",
+        }
+    }
+
+    /// The name of the 64-bit view of this register, e.g. `rax`.
+    fn name64(self) -> &'static str {
+        match self {
+            Self::Eax => "rax",
+            Self::Ecx => "rcx",
+            Self::Edx => "rdx",
+            Self::Esi => "rsi",
+            Self::Edi => "rdi",
+            Self::R8d => "r8",
+            Self::R9d => "r9",
+            Self::R10d => "r10",
+            Self::R11d => "r11",
+        }
+    }
+
+    /// The name of the low byte of this register, e.g. `al`. Needed by `sete`.
+    fn name8(self) -> &'static str {
+        match self {
+            Self::Eax => "al",
+            Self::Ecx => "cl",
+            Self::Edx => "dl",
+            Self::Esi => "sil",
+            Self::Edi => "dil",
+            Self::R8d => "r8b",
+            Self::R9d => "r9b",
+            Self::R10d => "r10b",
+            Self::R11d => "r11b",
+        }
+    }
+
+    /// This register's position in [`SCRATCH_REGS`], used to index the allocator's free table.
+    fn scratch_index(self) -> usize {
+        SCRATCH_REGS.iter().position(|&reg| reg == self).unwrap()
+    }
+}
+
+/// A single assembly instruction (or directive) in compact form.
+///
+/// Codegen emits these enum values into a vector rather than formatting text as it goes, so the
+/// hot path of the compiler is just pushes of small `Copy` values. The instruction list is also
+/// something later passes can inspect and rewrite (peephole optimization, say) before anything is
+/// ever turned into text.
+#[derive(Clone, Debug)]
+pub enum Instruction {
+    /// The `.globl` directive exposing a label to the linker.
+    Globl(String),
+
+    /// A label definition, e.g. `main:`.
+    Label(String),
+
+    /// Load an immediate into a register: `movl $value, %dst`.
+    MovImm { value: i32, dst: Reg },
+
+    /// Bitwise complement: `not %dst`.
+    Not { dst: Reg },
+
+    /// Arithmetic negation: `neg %dst`.
+    Neg { dst: Reg },
+
+    /// Compare a register against an immediate: `cmpl $value, %reg`.
+    CmpImm { value: i32, reg: Reg },
+
+    /// Set the low byte of a register to 1 if the last comparison was equal: `sete %dstb`.
+    Sete { dst: Reg },
+
+    /// Push the 64-bit view of a register onto the stack.
+    Push { src: Reg },
+
+    /// Pop the top of the stack into the 64-bit view of a register.
+    Pop { dst: Reg },
+
+    /// Addition: `addl %src, %dst`.
+    Add { src: Reg, dst: Reg },
+
+    /// Subtraction: `subl %src, %dst`.
+    Sub { src: Reg, dst: Reg },
+
+    /// Multiplication: `imul %src, %dst`.
+    Imul { src: Reg, dst: Reg },
+
+    /// Addition of an immediate: `addl $value, %dst`.
+    AddImm { value: i32, dst: Reg },
+
+    /// Subtraction of an immediate: `subl $value, %dst`.
+    SubImm { value: i32, dst: Reg },
+
+    /// Multiplication by an immediate: `imull $value, %dst, %dst`.
+    ImulImm { value: i32, dst: Reg },
+
+    /// Arithmetic right shift by an immediate: `sarl $shift, %dst`.
+    SarImm { shift: u32, dst: Reg },
+
+    /// Logical right shift by an immediate: `shrl $shift, %dst`.
+    ShrImm { shift: u32, dst: Reg },
+
+    /// Bitwise and with an immediate: `andl $value, %dst`.
+    AndImm { value: i32, dst: Reg },
+
+    /// Widening signed multiply: `imull %src` leaves the 64-bit product of `%eax` and the operand
+    /// in `edx:eax`.
+    ImulWide { src: Reg },
+
+    /// Sign extend `%eax` into `%edx`: `cdq`.
+    Cdq,
+
+    /// Signed division of `[edx:eax]` by a register: `idivl %src`.
+    Idiv { src: Reg },
+
+    /// Register to register move: `movl %src, %dst`.
+    Mov { src: Reg, dst: Reg },
+
+    /// Return from the current function.
+    Ret,
+}
+
+impl std::fmt::Display for Instruction {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            Self::Globl(name) => write!(f, "\t.globl {name}"),
+            Self::Label(name) => write!(f, "{name}:"),
+            Self::MovImm { value, dst } => write!(f, "\tmovl\t${value}, %{}", dst.name32()),
+            Self::Not { dst } => write!(f, "\tnot\t%{}", dst.name32()),
+            Self::Neg { dst } => write!(f, "\tneg\t%{}", dst.name32()),
+            Self::CmpImm { value, reg } => write!(f, "\tcmpl\t${value}, %{}", reg.name32()),
+            Self::Sete { dst } => write!(f, "\tsete\t%{}", dst.name8()),
+            Self::Push { src } => write!(f, "\tpush\t%{}", src.name64()),
+            Self::Pop { dst } => write!(f, "\tpop\t%{}", dst.name64()),
+            Self::Add { src, dst } => write!(f, "\taddl\t%{}, %{}", src.name32(), dst.name32()),
+            Self::Sub { src, dst } => write!(f, "\tsubl\t%{}, %{}", src.name32(), dst.name32()),
+            Self::Imul { src, dst } => write!(f, "\timul\t%{}, %{}", src.name32(), dst.name32()),
+            Self::AddImm { value, dst } => write!(f, "\taddl\t${value}, %{}", dst.name32()),
+            Self::SubImm { value, dst } => write!(f, "\tsubl\t${value}, %{}", dst.name32()),
+            Self::ImulImm { value, dst } => {
+                write!(f, "\timull\t${value}, %{0}, %{0}", dst.name32())
+            }
+            Self::SarImm { shift, dst } => write!(f, "\tsarl\t${shift}, %{}", dst.name32()),
+            Self::ShrImm { shift, dst } => write!(f, "\tshrl\t${shift}, %{}", dst.name32()),
+            Self::AndImm { value, dst } => write!(f, "\tandl\t${value}, %{}", dst.name32()),
+            Self::ImulWide { src } => write!(f, "\timull\t%{}", src.name32()),
+            Self::Cdq => write!(f, "\tcdq"),
+            Self::Idiv { src } => write!(f, "\tidivl\t%{}", src.name32()),
+            Self::Mov { src, dst } => write!(f, "\tmovl\t%{}, %{}", src.name32(), dst.name32()),
+            Self::Ret => write!(f, "\tret"),
+        }
     }
 }
 
+/// Where a temporary's value currently lives during instruction selection.
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+enum TempLoc {
+    /// Not defined yet.
+    Unset,
+
+    /// Live in the given register.
+    Reg(Reg),
+
+    /// Spilled; its value is somewhere on the machine stack.
+    Stack,
+
+    /// Already used by the one instruction that reads it.
+    Consumed,
+}
+
 /// The compiler.
 ///
-/// This class is responsible for turining an abstract syntax tree into
-/// assembly.
+/// This class is responsible for instruction selection: turning three-address IR into assembly.
+/// Codegen emits compact [`Instruction`] values into a vector, and the whole list is serialized
+/// to text exactly once in [`Compiler::finish`].
+///
+/// IR temporaries are mapped onto a pool of nine caller-saved scratch registers as instructions
+/// are selected, so typical expressions compile to pure register-to-register code. When the pool
+/// runs dry the oldest register-resident temporary is pushed onto the machine stack. Because the
+/// lowering in [`crate::ir`] produces temporaries with properly nested live ranges (each is
+/// defined once and consumed once, newest first), spilled values always come back off the stack
+/// in push order, so a plain push/pop pairing is enough - no stack frame needed.
 pub struct Compiler {
-    assembly: String,
+    instructions: Vec<Instruction>,
+    free: [bool; SCRATCH_REGS.len()],
+    reserved: [bool; SCRATCH_REGS.len()],
+    locations: Vec<TempLoc>,
+    live: Vec<ir::TempId>,
 }
 
 impl Compiler {
-    /// Create a new compiler with empty assembly buffer.
-    ///
-    /// # Examples
-    ///
-    /// ```
-    /// use ecc::compiler::Compiler;
-    ///
-    /// let compiler = Compiler::new();
-    ///
-    /// assert_eq!(compiler.get_code(), String::new());
-    /// ```
+    /// Create a new compiler with an empty instruction list and every scratch register free.
     fn new() -> Self {
         Self {
-            assembly: String::new(),
+            instructions: Vec::new(),
+            free: [true; SCRATCH_REGS.len()],
+            reserved: [false; SCRATCH_REGS.len()],
+            locations: Vec::new(),
+            live: Vec::new(),
         }
     }
 
-    fn finish(self) -> String {
-        self.assembly
+    /// Append an instruction to the output.
+    fn emit(&mut self, instruction: Instruction) {
+        self.instructions.push(instruction);
     }
 
-    /// Compile a program.
+    /// Allocate the first free scratch register, or [`None`] if the pool is exhausted.
+    fn alloc_reg(&mut self) -> Option<Reg> {
+        let index = self.free.iter().position(|&free| free)?;
+        self.free[index] = false;
+        Some(SCRATCH_REGS[index])
+    }
+
+    /// Allocate a scratch register, spilling the oldest register-resident temporary if none is
+    /// free. The returned register is busy either way and must be released (or handed to a
+    /// temporary) by the caller.
     ///
-    /// This method compiles a C program down to assembly. For now, a program consists of a single
-    /// function declaration. That function's name can be anything and the compiler will work, but
-    /// if the name is not `main` then the linker will complain.
-    fn compile_program(&mut self, program: ast::Program) {
-        self.compile_function(program.function);
+    /// A temporary sitting in a reserved register is never the victim: the division sequences
+    /// reserve `eax`/`edx` ahead of clobbering them, and evicting the resident temporary would
+    /// hand its register out as a scratch right in the path of the upcoming `imull`/`idivl`.
+    /// Skipping one leaves pop order intact - the spilled temporaries still go onto the stack
+    /// oldest-first and are consumed newest-first - and a spillable victim always exists, since
+    /// at most two of the nine registers are ever reserved at once.
+    fn alloc_reg_or_spill(&mut self) -> Reg {
+        if let Some(reg) = self.alloc_reg() {
+            return reg;
+        }
+
+        let victim = *self
+            .live
+            .iter()
+            .find(|&&temp| match self.locations[temp.index()] {
+                TempLoc::Reg(reg) => !self.reserved[reg.scratch_index()],
+                _ => false,
+            })
+            .expect("register pool exhausted with no spillable temporary");
+
+        let TempLoc::Reg(reg) = self.locations[victim.index()] else {
+            unreachable!();
+        };
+
+        self.emit(Instruction::Push { src: reg });
+        self.locations[victim.index()] = TempLoc::Stack;
+        reg
     }
 
-    /// Compile a function.
+    /// Take a specific register out of the pool if it is free, and reserve it either way.
     ///
-    /// This method generates a global instruction to expose the function's label to the linker.
-    /// Then it generates a label corresponding to the function's name, followed by all of the code
-    /// for the function.
-    fn compile_function(&mut self, function: ast::Function) {
-        writeln_unwrap!(self.assembly, "\t.globl {}", function.name);
-        writeln_unwrap!(self.assembly, "{}:", function.name);
+    /// Returns whether the register was actually free; the caller should only release it again if
+    /// it was, since a busy register belongs to a live temporary. Reserving keeps the spiller
+    /// from evicting that temporary and reusing the register while the caller is counting on it;
+    /// the reservation lasts until the register is released or explicitly unreserved.
+    fn take_reg(&mut self, reg: Reg) -> bool {
+        let index = reg.scratch_index();
+        let was_free = self.free[index];
+        self.free[index] = false;
+        self.reserved[index] = true;
+        was_free
+    }
 
-        for statement in function.body {
-            self.compile_statement(statement);
-        }
+    /// Return a register to the pool, lifting any reservation on it.
+    fn release_reg(&mut self, reg: Reg) {
+        self.free[reg.scratch_index()] = true;
+        self.reserved[reg.scratch_index()] = false;
     }
 
-    /// Compile a statement.
+    /// Lift a reservation without freeing the register, for when it goes back to the live
+    /// temporary that owned it all along.
+    fn unreserve(&mut self, reg: Reg) {
+        self.reserved[reg.scratch_index()] = false;
+    }
+
+    /// Mark a temporary as read by its one consumer and drop it from the live list.
     ///
-    /// This method compiles a single statement. The generated assembly (obviously) depends greatly
-    /// on the type of statement being compiled.
-    fn compile_statement(&mut self, statement: ast::Statement) {
-        match statement {
-            ast::Statement::Return(expr) => self.compile_return(expr),
-        }
+    /// The register it occupied (if any) is not released here - ownership passes to the caller,
+    /// which usually reuses it as the destination of the instruction being selected.
+    fn consume(&mut self, temp: ir::TempId) {
+        self.locations[temp.index()] = TempLoc::Consumed;
+        let position = self.live.iter().position(|&t| t == temp).unwrap();
+        self.live.remove(position);
     }
 
-    /// Compile a return statement.
+    /// Record that a temporary now lives in the given (busy) register.
+    fn define(&mut self, temp: ir::TempId, reg: Reg) {
+        self.locations[temp.index()] = TempLoc::Reg(reg);
+        self.live.push(temp);
+    }
+
+    /// Materialize a value into a register owned by the caller.
     ///
-    /// This method generates a `movl` instruction, passing it the integer return value and the
-    /// `%eax` register. In the future, functions will be able to return more than 32-bit integer
-    /// values, but this is how it is for now. Naturally, the return statement is terminated with a
-    /// `ret` instruction.
-    fn compile_return(&mut self, return_value: ast::Expr) {
-        self.compile_expression(return_value);
-        writeln_unwrap!(self.assembly, "\tret");
+    /// Constants are loaded into a fresh register; temporaries are consumed, either handing over
+    /// the register they already occupy or popping their spilled value into a fresh one. Operands
+    /// must be materialized newest-first (right before left) so that pops mirror the spill pushes.
+    fn value_reg(&mut self, value: ir::Value) -> Reg {
+        match value {
+            ir::Value::Constant(constant) => {
+                let reg = self.alloc_reg_or_spill();
+                self.emit(Instruction::MovImm {
+                    value: constant,
+                    dst: reg,
+                });
+
+                reg
+            }
+            ir::Value::Temp(temp) => match self.locations[temp.index()] {
+                TempLoc::Reg(reg) => {
+                    self.consume(temp);
+                    reg
+                }
+                TempLoc::Stack => {
+                    self.consume(temp);
+
+                    // A spilled operand implies every older temporary is spilled too (save at
+                    // most the pair parked in reserved registers), so the registers cannot all
+                    // be claimed by live values - this allocation never needs to spill (which
+                    // would corrupt the pop order).
+                    let reg = self.alloc_reg().expect("no free register to pop into");
+                    self.emit(Instruction::Pop { dst: reg });
+                    reg
+                }
+                TempLoc::Unset | TempLoc::Consumed => {
+                    panic!("ill-formed IR: temporary used while not live")
+                }
+            },
+        }
     }
 
-    /// Compile an expression.
+    /// Compile a function.
     ///
-    /// For now, all manipulation of expressions happens in the `eax` register. This is because the
-    /// only meaningful thing that we can do is return an integer from `main`, and since that
-    /// integer must be stored in `eax` according to the calling convention, it is a logical
-    /// register to use for operations.
-    fn compile_expression(&mut self, expr: ast::Expr) {
-        match expr {
-            ast::Expr::Integer(value) => self.compile_integer(value),
-            ast::Expr::Unary { operator, operand } => self.compile_unary(operator, *operand),
-            ast::Expr::Binary {
-                operator,
+    /// This method generates a global instruction to expose the function's label to the linker,
+    /// then a label corresponding to the function's name, followed by the code selected for each
+    /// IR instruction in order.
+    fn compile_function(&mut self, function: &ir::Function, symbols: &Interner) {
+        self.locations = vec![TempLoc::Unset; function.temp_count as usize];
+
+        // The name is only materialized as text here, at the edge where it gets written out.
+        let name = symbols.resolve(function.name);
+        self.emit(Instruction::Globl(name.to_owned()));
+        self.emit(Instruction::Label(name.to_owned()));
+
+        for &instruction in &function.instructions {
+            self.compile_instruction(instruction);
+        }
+    }
+
+    /// Select assembly for one IR instruction.
+    fn compile_instruction(&mut self, instruction: ir::Instruction) {
+        match instruction {
+            ir::Instruction::Unary { op, src, dst } => self.compile_unary(op, src, dst),
+            ir::Instruction::Binary {
+                op,
                 left,
                 right,
-            } => self.compile_binary(operator, *left, *right),
+                dst,
+            } => self.compile_binary(op, left, right, dst),
+            ir::Instruction::Return(value) => self.compile_return(value),
         }
     }
 
-    /// Compile an integer literal.
+    /// Select assembly for a return.
     ///
-    /// This method loads the given integer into the `eax` register.
-    fn compile_integer(&mut self, value: i32) {
-        writeln_unwrap!(self.assembly, "\tmovl\t${}, %eax", value);
+    /// The calling convention wants the return value in `eax`.
+    fn compile_return(&mut self, value: ir::Value) {
+        match value {
+            ir::Value::Constant(constant) => self.emit(Instruction::MovImm {
+                value: constant,
+                dst: Reg::Eax,
+            }),
+            ir::Value::Temp(temp) => match self.locations[temp.index()] {
+                TempLoc::Reg(Reg::Eax) => self.consume(temp),
+                TempLoc::Reg(reg) => {
+                    self.consume(temp);
+                    self.release_reg(reg);
+                    self.emit(Instruction::Mov {
+                        src: reg,
+                        dst: Reg::Eax,
+                    });
+                }
+                TempLoc::Stack => {
+                    self.consume(temp);
+                    self.emit(Instruction::Pop { dst: Reg::Eax });
+                }
+                TempLoc::Unset | TempLoc::Consumed => {
+                    panic!("ill-formed IR: temporary used while not live")
+                }
+            },
+        }
+
+        self.emit(Instruction::Ret);
     }
 
-    /// Compile a unary expression.
-    fn compile_unary(&mut self, op: ast::UnaryOp, operand: ast::Expr) {
-        self.compile_expression(operand);
+    /// Select assembly for a unary operation.
+    ///
+    /// The destination reuses the operand's register, so unary chains stay in one register.
+    fn compile_unary(&mut self, op: ast::UnaryOp, src: ir::Value, dst: ir::TempId) {
+        let reg = self.value_reg(src);
 
-        use ast::UnaryOp as UO; // 'Sco Ducks
+        use ast::UnaryOp as UO;
 
         match op {
-            UO::Compliment => writeln_unwrap!(self.assembly, "\tnot\t%eax"),
-            UO::NegateArith => writeln_unwrap!(self.assembly, "\tneg\t%eax"),
+            UO::Compliment => self.emit(Instruction::Not { dst: reg }),
+            UO::NegateArith => self.emit(Instruction::Neg { dst: reg }),
             UO::NegateLogical => {
-                writeln_unwrap!(self.assembly, "\tcmpl\t$0, %eax");
-                writeln_unwrap!(self.assembly, "\tmovl\t$0, %eax");
-                writeln_unwrap!(self.assembly, "\tsete\t%al");
+                self.emit(Instruction::CmpImm { value: 0, reg });
+
+                // Careful: `mov` leaves the flags alone, which is the only reason clearing the
+                // register between the compare and the `sete` is legal.
+                self.emit(Instruction::MovImm { value: 0, dst: reg });
+                self.emit(Instruction::Sete { dst: reg });
             }
         }
-    }
 
-    fn compile_binary(&mut self, op: ast::BinaryOp, left: ast::Expr, right: ast::Expr) {
-        // Stupid hack because I can't link in 32 bit mode for some reason...
-        self.compile_expression(right);
-        writeln_unwrap!(self.assembly, "\tpush\t%rax");
-        self.compile_expression(left);
-        writeln_unwrap!(self.assembly, "\tpop\t%rcx");
+        self.define(dst, reg);
+    }
 
+    /// Select assembly for a binary operation.
+    ///
+    /// The left operand's register becomes the destination, and a constant right operand is
+    /// encoded as an immediate, so `x * 4` style operations cost a single instruction and no
+    /// extra register. The right operand is materialized before the left to keep spill pops in
+    /// push order.
+    fn compile_binary(&mut self, op: ast::BinaryOp, left: ir::Value, right: ir::Value, dst: ir::TempId) {
         use ast::BinaryOp as BO;
 
-        match op {
-            BO::Plus => writeln_unwrap!(self.assembly, "\taddl\t%ecx, %eax"),
-            BO::Times => writeln_unwrap!(self.assembly, "\timul\t%ecx, %eax"),
-            BO::Minus => writeln_unwrap!(self.assembly, "\tsubl\t%ecx, %eax"),
-
-            // The `idivl` instruction interprets `[edx:eax]` as a single 64-bit register, so
-            // before we execute `idivl`, we must sign extend `eax` into `edx`, which is exactly
-            // what `cdq` does.
-            BO::Divide => {
-                writeln_unwrap!(self.assembly, "\tcdq");
-                writeln_unwrap!(self.assembly, "\tidivl\t%ecx");
+        if let BO::Divide | BO::Mod = op {
+            // A nonzero constant divisor never has to touch the hardware divider. Zero keeps the
+            // idiv path so the program still faults at runtime the way gcc's output does.
+            if let ir::Value::Constant(divisor) = right
+                && divisor != 0
+            {
+                return self.compile_divide_by_constant(op, left, divisor, dst);
+            }
+
+            return self.compile_divide(op, left, right, dst);
+        }
+
+        let rhs = match right {
+            ir::Value::Constant(value) => Err(value),
+            ir::Value::Temp(_) => Ok(self.value_reg(right)),
+        };
+
+        let dst_reg = self.value_reg(left);
+
+        match (op, rhs) {
+            (BO::Plus, Ok(src)) => self.emit(Instruction::Add { src, dst: dst_reg }),
+            (BO::Minus, Ok(src)) => self.emit(Instruction::Sub { src, dst: dst_reg }),
+            (BO::Times, Ok(src)) => self.emit(Instruction::Imul { src, dst: dst_reg }),
+            (BO::Plus, Err(value)) => self.emit(Instruction::AddImm { value, dst: dst_reg }),
+            (BO::Minus, Err(value)) => self.emit(Instruction::SubImm { value, dst: dst_reg }),
+            (BO::Times, Err(value)) => self.emit(Instruction::ImulImm { value, dst: dst_reg }),
+            (BO::Divide | BO::Mod, _) => unreachable!(),
+        }
+
+        if let Ok(src) = rhs {
+            self.release_reg(src);
+        }
+
+        self.define(dst, dst_reg);
+    }
+
+    /// Select assembly for a division or remainder.
+    ///
+    /// `idivl` is picky: the dividend must sit in `[edx:eax]` and the quotient and remainder come
+    /// back in `eax` and `edx`. Both registers are reserved up front; whichever of them hold live
+    /// values belonging to other temporaries are saved around the division. The result lands in
+    /// the divisor's register, which is the one register guaranteed to be safely ours and outside
+    /// the `eax`/`edx` pair.
+    fn compile_divide(&mut self, op: ast::BinaryOp, left: ir::Value, right: ir::Value, dst: ir::TempId) {
+        let mut took_eax = self.take_reg(Reg::Eax);
+        let mut took_edx = self.take_reg(Reg::Edx);
+
+        // The divisor has to survive the dividend shuffle and the `cdq`, so it cannot stay in
+        // eax or edx; move it out if that is where it happens to live.
+        let mut divisor = self.value_reg(right);
+        if divisor == Reg::Eax || divisor == Reg::Edx {
+            let fresh = self.alloc_reg_or_spill();
+            self.emit(Instruction::Mov {
+                src: divisor,
+                dst: fresh,
+            });
+
+            // The old register belonged to the (now consumed) right operand; it is ours now.
+            if divisor == Reg::Eax {
+                took_eax = true;
+            } else {
+                took_edx = true;
+            }
+
+            divisor = fresh;
+        }
+
+        let left_home = match left {
+            ir::Value::Temp(temp) => self.locations[temp.index()],
+            ir::Value::Constant(_) => TempLoc::Unset,
+        };
+
+        // If eax or edx was neither free nor about to be consumed as the left operand, some
+        // other live temporary owns it and its value must survive the division.
+        let save_eax = !took_eax && left_home != TempLoc::Reg(Reg::Eax);
+        let save_edx = !took_edx && left_home != TempLoc::Reg(Reg::Edx);
+
+        if save_eax {
+            self.emit(Instruction::Push { src: Reg::Eax });
+        }
+        if save_edx {
+            self.emit(Instruction::Push { src: Reg::Edx });
+        }
+
+        // Materialize the dividend in eax.
+        match left {
+            ir::Value::Constant(constant) => self.emit(Instruction::MovImm {
+                value: constant,
+                dst: Reg::Eax,
+            }),
+            ir::Value::Temp(temp) => {
+                self.consume(temp);
+                match left_home {
+                    TempLoc::Reg(Reg::Eax) => {}
+                    TempLoc::Reg(reg) => {
+                        self.emit(Instruction::Mov {
+                            src: reg,
+                            dst: Reg::Eax,
+                        });
+                        self.release_reg(reg);
+                    }
+                    TempLoc::Stack => self.emit(Instruction::Pop { dst: Reg::Eax }),
+                    TempLoc::Unset | TempLoc::Consumed => {
+                        panic!("ill-formed IR: temporary used while not live")
+                    }
+                }
+            }
+        }
+
+        self.emit(Instruction::Cdq);
+        self.emit(Instruction::Idiv { src: divisor });
+
+        let result = match op {
+            ast::BinaryOp::Divide => Reg::Eax,
+            ast::BinaryOp::Mod => Reg::Edx,
+            _ => unreachable!(),
+        };
+
+        self.emit(Instruction::Mov {
+            src: result,
+            dst: divisor,
+        });
+        self.define(dst, divisor);
+
+        if save_edx {
+            self.emit(Instruction::Pop { dst: Reg::Edx });
+            self.unreserve(Reg::Edx);
+        } else {
+            self.release_reg(Reg::Edx);
+        }
+
+        if save_eax {
+            self.emit(Instruction::Pop { dst: Reg::Eax });
+            self.unreserve(Reg::Eax);
+        } else {
+            self.release_reg(Reg::Eax);
+        }
+    }
+
+    /// Select assembly for a division or remainder by a nonzero constant divisor.
+    ///
+    /// `idivl` is a 20+ cycle instruction on every core we target, and most divisions in real
+    /// code are by constants (strides, bucket counts). Divisors of ±1 reduce to a move or a
+    /// negate, powers of two to a shift (with the bias that makes shifting match C's
+    /// truncate-toward-zero on negative dividends), and everything else to the classic
+    /// multiply-by-magic-number sequence, so generated code only ever divides in hardware when
+    /// the divisor is genuinely unknown.
+    fn compile_divide_by_constant(
+        &mut self,
+        op: ast::BinaryOp,
+        left: ir::Value,
+        divisor: i32,
+        dst: ir::TempId,
+    ) {
+        let wants_remainder = matches!(op, ast::BinaryOp::Mod);
+
+        if divisor == 1 || divisor == -1 {
+            let reg = self.value_reg(left);
+            if wants_remainder {
+                self.emit(Instruction::MovImm { value: 0, dst: reg });
+            } else if divisor == -1 {
+                self.emit(Instruction::Neg { dst: reg });
             }
 
-            // Same story here as for division, but the remainder is stored in the `edx` register.
-            BO::Mod => {
-                writeln_unwrap!(self.assembly, "\tcdq");
-                writeln_unwrap!(self.assembly, "\tidivl\t%ecx");
-                writeln_unwrap!(self.assembly, "\tmovl\t%edx, %eax");
+            self.define(dst, reg);
+            return;
+        }
+
+        if divisor.unsigned_abs().is_power_of_two() {
+            let k = divisor.unsigned_abs().trailing_zeros();
+            let reg = self.value_reg(left);
+            let bias = self.alloc_reg_or_spill();
+
+            // bias = (n >> 31) >>> (32 - k): 2^k - 1 when n is negative, 0 otherwise. Adding it
+            // before the shift (or mask) and compensating afterwards is what turns a
+            // floor-flavoured shift into C's truncating division.
+            self.emit(Instruction::Mov {
+                src: reg,
+                dst: bias,
+            });
+            self.emit(Instruction::SarImm {
+                shift: 31,
+                dst: bias,
+            });
+            self.emit(Instruction::ShrImm {
+                shift: 32 - k,
+                dst: bias,
+            });
+            self.emit(Instruction::Add {
+                src: bias,
+                dst: reg,
+            });
+
+            if wants_remainder {
+                // n % d == n % |d| for truncating division, so the sign of the divisor is moot.
+                self.emit(Instruction::AndImm {
+                    value: (divisor.unsigned_abs() - 1) as i32,
+                    dst: reg,
+                });
+                self.emit(Instruction::Sub {
+                    src: bias,
+                    dst: reg,
+                });
+            } else {
+                self.emit(Instruction::SarImm { shift: k, dst: reg });
+                if divisor < 0 {
+                    self.emit(Instruction::Neg { dst: reg });
+                }
+            }
+
+            self.release_reg(bias);
+            self.define(dst, reg);
+            return;
+        }
+
+        // The general case multiplies by a magic constant and keeps the high half, which needs
+        // the same edx:eax choreography as idiv itself.
+        let (multiplier, shift) = divide_magic(divisor);
+
+        let mut took_eax = self.take_reg(Reg::Eax);
+        let mut took_edx = self.take_reg(Reg::Edx);
+
+        // The dividend has to sit outside the eax/edx pair for the widening multiply.
+        let mut n = self.value_reg(left);
+        if n == Reg::Eax || n == Reg::Edx {
+            let fresh = self.alloc_reg_or_spill();
+            self.emit(Instruction::Mov { src: n, dst: fresh });
+
+            if n == Reg::Eax {
+                took_eax = true;
+            } else {
+                took_edx = true;
             }
+
+            n = fresh;
+        }
+
+        // The remainder path needs one more scratch register; claim it before the saves go onto
+        // the stack so any spill push stays properly nested around them.
+        let scratch = wants_remainder.then(|| self.alloc_reg_or_spill());
+
+        let save_eax = !took_eax;
+        let save_edx = !took_edx;
+
+        if save_eax {
+            self.emit(Instruction::Push { src: Reg::Eax });
+        }
+        if save_edx {
+            self.emit(Instruction::Push { src: Reg::Edx });
+        }
+
+        self.emit(Instruction::MovImm {
+            value: multiplier,
+            dst: Reg::Eax,
+        });
+        self.emit(Instruction::ImulWide { src: n });
+
+        // When the magic constant could not be kept in range its sign is off by one multiple of
+        // 2^32, which a single add or subtract of the dividend repairs.
+        if divisor > 0 && multiplier < 0 {
+            self.emit(Instruction::Add {
+                src: n,
+                dst: Reg::Edx,
+            });
         }
+        if divisor < 0 && multiplier > 0 {
+            self.emit(Instruction::Sub {
+                src: n,
+                dst: Reg::Edx,
+            });
+        }
+
+        if shift > 0 {
+            self.emit(Instruction::SarImm {
+                shift,
+                dst: Reg::Edx,
+            });
+        }
+
+        if let Some(scratch) = scratch {
+            // q += q >>> 31: one more when the quotient is negative. The correction has to come
+            // from the quotient's own sign, not the dividend's - they only agree for positive
+            // divisors. Computed in the scratch so the dividend survives for the remainder below.
+            self.emit(Instruction::Mov {
+                src: Reg::Edx,
+                dst: scratch,
+            });
+            self.emit(Instruction::ShrImm {
+                shift: 31,
+                dst: scratch,
+            });
+            self.emit(Instruction::Add {
+                src: scratch,
+                dst: Reg::Edx,
+            });
+
+            // remainder = n - q * d
+            self.emit(Instruction::ImulImm {
+                value: divisor,
+                dst: Reg::Edx,
+            });
+            self.emit(Instruction::Sub {
+                src: Reg::Edx,
+                dst: n,
+            });
+
+            self.release_reg(scratch);
+        } else {
+            // Same correction, but the dividend is dead here, so it can hold the quotient's
+            // sign bit and then accumulate the result.
+            self.emit(Instruction::Mov {
+                src: Reg::Edx,
+                dst: n,
+            });
+            self.emit(Instruction::ShrImm { shift: 31, dst: n });
+            self.emit(Instruction::Add {
+                src: Reg::Edx,
+                dst: n,
+            });
+        }
+
+        if save_edx {
+            self.emit(Instruction::Pop { dst: Reg::Edx });
+            self.unreserve(Reg::Edx);
+        } else {
+            self.release_reg(Reg::Edx);
+        }
+
+        if save_eax {
+            self.emit(Instruction::Pop { dst: Reg::Eax });
+            self.unreserve(Reg::Eax);
+        } else {
+            self.release_reg(Reg::Eax);
+        }
+
+        self.define(dst, n);
     }
 }
+
+/// Compute the magic multiplier and post-shift for signed division by a constant.
+///
+/// This is the classic algorithm from Hacker's Delight (figure 10-1): find the smallest shift
+/// whose corresponding multiplier approximates 1/divisor closely enough to be exact for every
+/// 32-bit dividend. The multiplier is returned as the (possibly wrapped-negative) 32-bit value
+/// codegen loads into `eax`.
+fn divide_magic(divisor: i32) -> (i32, u32) {
+    let two31: u64 = 1 << 31;
+    let ad = u64::from(divisor.unsigned_abs());
+    let t = two31 + (u64::from(divisor as u32) >> 31);
+    let anc = t - 1 - t % ad;
+
+    let mut p: u32 = 31;
+    let mut q1 = two31 / anc;
+    let mut r1 = two31 - q1 * anc;
+    let mut q2 = two31 / ad;
+    let mut r2 = two31 - q2 * ad;
+
+    loop {
+        p += 1;
+        q1 *= 2;
+        r1 *= 2;
+        if r1 >= anc {
+            q1 += 1;
+            r1 -= anc;
+        }
+
+        q2 *= 2;
+        r2 *= 2;
+        if r2 >= ad {
+            q2 += 1;
+            r2 -= ad;
+        }
+
+        if q1 >= ad - r2 && !(q1 == ad - r2 && r1 == 0) {
+            break;
+        }
+    }
+
+    let magic = (q2 + 1) as u32 as i32;
+    let magic = if divisor < 0 {
+        magic.wrapping_neg()
+    } else {
+        magic
+    };
+
+    (magic, p - 32)
+}
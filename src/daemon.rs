@@ -0,0 +1,108 @@
+//! Persistent compile-server mode.
+//!
+//! Launching a fresh process per translation unit means every tiny file pays process startup and
+//! runs the whole pipeline cold. The daemon keeps one resident `ecc` alive behind a Unix socket:
+//! code pages stay warm, allocator arenas stay primed, and the object cache directory is consulted
+//! by a process that never goes away. A build system driving thousands of small generated files
+//! submits paths over the socket and gets per-file results back, paying startup exactly once.
+//!
+//! The protocol is deliberately plain text so it can be exercised from a shell:
+//!
+//! ```text
+//! $ ecc --daemon /tmp/ecc.sock -c &
+//! $ printf 'foo.c\nbar.c\n' | nc -U /tmp/ecc.sock
+//! ok foo.c
+//! ok bar.c
+//! ```
+//!
+//! Each line the client sends is a source file path; the daemon compiles it with the flags the
+//! daemon itself was launched with (`-c`, `--cache-dir`) and answers with one line, either
+//! `ok <path>` or `err <path>: <message>`. The single word `shutdown` stops the server.
+
+use std::io::{BufRead, BufReader, Write};
+use std::os::unix::net::{UnixListener, UnixStream};
+use std::path::Path;
+
+use crate::CompileError;
+
+/// The options a daemon applies to every file submitted to it.
+///
+/// These mirror the command line flags: the build system picks them once when it launches the
+/// daemon, rather than renegotiating them per request.
+#[derive(Clone, Copy, Default)]
+pub struct DaemonOptions<'a> {
+    /// Stop after writing the object file instead of linking, as with `-c`.
+    pub compile_only: bool,
+
+    /// Where to keep cached object files, as with `--cache-dir`.
+    pub cache_dir: Option<&'a Path>,
+}
+
+/// Bind the socket and serve compile requests until a client sends `shutdown`.
+///
+/// A stale socket file from a previous run is removed before binding, so restarting the daemon
+/// just works. Connections are served one at a time off the accept loop; the per-file pipeline
+/// already fans its code generation out across threads, and keeping the loop serial means replies
+/// always land in the order requests were sent.
+pub fn run(socket_path: &Path, options: DaemonOptions) -> std::io::Result<()> {
+    match std::fs::remove_file(socket_path) {
+        Err(error) if error.kind() != std::io::ErrorKind::NotFound => return Err(error),
+        _ => {}
+    }
+
+    let listener = UnixListener::bind(socket_path)?;
+
+    for stream in listener.incoming() {
+        // A client that disconnects mid-request should not take the server down with it, so
+        // per-connection I/O errors are swallowed and the loop moves on to the next client.
+        match serve_connection(stream?, options) {
+            Ok(true) => {}
+            Ok(false) => break,
+            Err(_) => {}
+        }
+    }
+
+    std::fs::remove_file(socket_path)
+}
+
+/// Serve one client, returning false once a `shutdown` request has been honoured.
+fn serve_connection(stream: UnixStream, options: DaemonOptions) -> std::io::Result<bool> {
+    let mut reader = BufReader::new(&stream);
+    let mut writer = &stream;
+    let mut line = String::new();
+
+    loop {
+        line.clear();
+        if reader.read_line(&mut line)? == 0 {
+            return Ok(true);
+        }
+
+        let request = line.trim();
+        if request.is_empty() {
+            continue;
+        }
+
+        if request == "shutdown" {
+            writeln!(writer, "ok shutdown")?;
+            return Ok(false);
+        }
+
+        match compile_request(request, options) {
+            Ok(()) => writeln!(writer, "ok {request}")?,
+            Err(error) => {
+                // The reply must stay on one line; a linker error can span several.
+                let message = error.to_string().replace('\n', " ");
+                writeln!(writer, "err {request}: {message}")?;
+            }
+        }
+    }
+}
+
+/// Compile a single submitted file with the daemon's options.
+fn compile_request(path: &str, options: DaemonOptions) -> Result<(), CompileError> {
+    if options.compile_only {
+        crate::try_compile_object_with_cache(path, options.cache_dir)
+    } else {
+        crate::try_compile_and_link_with_cache(path, options.cache_dir)
+    }
+}
@@ -0,0 +1,461 @@
+//! An ELF relocatable-object writer.
+//!
+//! Shelling out to `gcc` to assemble our textual output costs a process spawn and a full parse of
+//! text we only just finished formatting - on small files that subprocess dominates the compile.
+//! This module cuts the assembler out of the loop: it encodes the back end's [`Instruction`] list
+//! directly into `x86_64` machine code and wraps the bytes in a minimal ELF relocatable object,
+//! so the only external tool left in the pipeline is the final link (and `-c` skips even that).
+//!
+//! The object is as small as ELF allows: a `.text` section holding the code, a symbol table
+//! exposing each function label, the two string tables, and an empty `.note.GNU-stack` section so
+//! the linker knows we do not want an executable stack. No relocations are needed because the
+//! code we generate never references anything outside itself.
+
+use crate::compiler::{Instruction, Reg};
+
+/// Encode a selected instruction list into the bytes of an ELF relocatable object.
+pub fn write_object(instructions: &[Instruction]) -> Vec<u8> {
+    let (code, symbols) = encode(instructions);
+    build_elf(&code, &symbols)
+}
+
+/// A function symbol defined in the object's text section.
+struct Symbol {
+    name: String,
+    offset: u64,
+    size: u64,
+    global: bool,
+}
+
+/// The hardware number of a register, as used in ModRM bytes and opcode encodings.
+///
+/// Numbers 8 and up belong to the `r8`-`r15` family and need a REX prefix bit to reach.
+fn reg_number(reg: Reg) -> u8 {
+    match reg {
+        Reg::Eax => 0,
+        Reg::Ecx => 1,
+        Reg::Edx => 2,
+        Reg::Esi => 6,
+        Reg::Edi => 7,
+        Reg::R8d => 8,
+        Reg::R9d => 9,
+        Reg::R10d => 10,
+        Reg::R11d => 11,
+    }
+}
+
+/// The machine code encoder.
+///
+/// Each [`Instruction`] variant has exactly one encoding here, chosen to match what an assembler
+/// would pick: immediates that fit in a signed byte use the short ALU forms, and REX prefixes are
+/// only emitted when a high register (or a byte view of `sil`/`dil`) forces one.
+struct Encoder {
+    code: Vec<u8>,
+    symbols: Vec<Symbol>,
+    globals: Vec<String>,
+}
+
+/// Encode every instruction, returning the text section bytes and the symbols defined in them.
+fn encode(instructions: &[Instruction]) -> (Vec<u8>, Vec<Symbol>) {
+    let mut encoder = Encoder {
+        code: Vec::new(),
+        symbols: Vec::new(),
+        globals: Vec::new(),
+    };
+
+    for instruction in instructions {
+        encoder.encode_instruction(instruction);
+    }
+
+    encoder.finish()
+}
+
+impl Encoder {
+    /// Close out the open symbol sizes and apply the collected `.globl` markings.
+    fn finish(mut self) -> (Vec<u8>, Vec<Symbol>) {
+        let end = self.code.len() as u64;
+        for symbol in &mut self.symbols {
+            symbol.global = self.globals.contains(&symbol.name);
+        }
+
+        // A label's code runs until the next label (or the end of the section).
+        for index in 0..self.symbols.len() {
+            let next = self
+                .symbols
+                .get(index + 1)
+                .map(|symbol| symbol.offset)
+                .unwrap_or(end);
+            self.symbols[index].size = next - self.symbols[index].offset;
+        }
+
+        (self.code, self.symbols)
+    }
+
+    /// Emit one byte of machine code.
+    fn byte(&mut self, byte: u8) {
+        self.code.push(byte);
+    }
+
+    /// Emit a 32-bit immediate in little-endian order.
+    fn imm32(&mut self, value: i32) {
+        self.code.extend_from_slice(&value.to_le_bytes());
+    }
+
+    /// Emit a ModRM byte in register-direct mode.
+    fn modrm(&mut self, reg: u8, rm: u8) {
+        self.byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    /// Emit a REX prefix if either operand register needs its extension bit.
+    ///
+    /// `reg` extends the ModRM reg field (REX.R) and `rm` extends the rm field (REX.B). All of
+    /// our arithmetic is 32-bit, so REX.W is never set.
+    fn rex(&mut self, reg: u8, rm: u8) {
+        let r = if reg >= 8 { 0b100 } else { 0 };
+        let b = if rm >= 8 { 0b001 } else { 0 };
+        if r | b != 0 {
+            self.byte(0x40 | r | b);
+        }
+    }
+
+    /// Emit a 32-bit ALU operation with an immediate operand, using the sign-extended byte form
+    /// when the immediate allows it.
+    fn alu_imm(&mut self, extension: u8, value: i32, rm: u8) {
+        self.rex(0, rm);
+        if let Ok(short) = i8::try_from(value) {
+            self.byte(0x83);
+            self.modrm(extension, rm);
+            self.byte(short as u8);
+        } else {
+            self.byte(0x81);
+            self.modrm(extension, rm);
+            self.imm32(value);
+        }
+    }
+
+    /// Encode a single instruction (or record what a directive declares).
+    fn encode_instruction(&mut self, instruction: &Instruction) {
+        match instruction {
+            Instruction::Globl(name) => self.globals.push(name.clone()),
+            Instruction::Label(name) => self.symbols.push(Symbol {
+                name: name.clone(),
+                offset: self.code.len() as u64,
+                size: 0,
+                global: false,
+            }),
+            Instruction::MovImm { value, dst } => {
+                let dst = reg_number(*dst);
+                self.rex(0, dst);
+                self.byte(0xb8 + (dst & 7));
+                self.imm32(*value);
+            }
+            Instruction::Not { dst } => {
+                let dst = reg_number(*dst);
+                self.rex(0, dst);
+                self.byte(0xf7);
+                self.modrm(2, dst);
+            }
+            Instruction::Neg { dst } => {
+                let dst = reg_number(*dst);
+                self.rex(0, dst);
+                self.byte(0xf7);
+                self.modrm(3, dst);
+            }
+            Instruction::CmpImm { value, reg } => self.alu_imm(7, *value, reg_number(*reg)),
+            Instruction::Sete { dst } => {
+                let dst = reg_number(*dst);
+
+                // Byte registers are the one place a do-nothing REX matters: without a prefix,
+                // rm values 4-7 mean `ah`-`bh`, and only with one do they mean `sil` and friends.
+                if dst >= 4 {
+                    self.byte(0x40 | if dst >= 8 { 0b001 } else { 0 });
+                }
+
+                self.byte(0x0f);
+                self.byte(0x94);
+                self.modrm(0, dst);
+            }
+            Instruction::Push { src } => {
+                let src = reg_number(*src);
+                self.rex(0, src);
+                self.byte(0x50 + (src & 7));
+            }
+            Instruction::Pop { dst } => {
+                let dst = reg_number(*dst);
+                self.rex(0, dst);
+                self.byte(0x58 + (dst & 7));
+            }
+            Instruction::Add { src, dst } => {
+                let (src, dst) = (reg_number(*src), reg_number(*dst));
+                self.rex(src, dst);
+                self.byte(0x01);
+                self.modrm(src, dst);
+            }
+            Instruction::Sub { src, dst } => {
+                let (src, dst) = (reg_number(*src), reg_number(*dst));
+                self.rex(src, dst);
+                self.byte(0x29);
+                self.modrm(src, dst);
+            }
+            Instruction::Imul { src, dst } => {
+                // `imul` reads the destination from the reg field, unlike the other ALU ops.
+                let (src, dst) = (reg_number(*src), reg_number(*dst));
+                self.rex(dst, src);
+                self.byte(0x0f);
+                self.byte(0xaf);
+                self.modrm(dst, src);
+            }
+            Instruction::AddImm { value, dst } => self.alu_imm(0, *value, reg_number(*dst)),
+            Instruction::SubImm { value, dst } => self.alu_imm(5, *value, reg_number(*dst)),
+            Instruction::ImulImm { value, dst } => {
+                let dst = reg_number(*dst);
+                self.rex(dst, dst);
+                if let Ok(short) = i8::try_from(*value) {
+                    self.byte(0x6b);
+                    self.modrm(dst, dst);
+                    self.byte(short as u8);
+                } else {
+                    self.byte(0x69);
+                    self.modrm(dst, dst);
+                    self.imm32(*value);
+                }
+            }
+            Instruction::SarImm { shift, dst } => {
+                let dst = reg_number(*dst);
+                self.rex(0, dst);
+                self.byte(0xc1);
+                self.modrm(7, dst);
+                self.byte(*shift as u8);
+            }
+            Instruction::ShrImm { shift, dst } => {
+                let dst = reg_number(*dst);
+                self.rex(0, dst);
+                self.byte(0xc1);
+                self.modrm(5, dst);
+                self.byte(*shift as u8);
+            }
+            Instruction::AndImm { value, dst } => self.alu_imm(4, *value, reg_number(*dst)),
+            Instruction::ImulWide { src } => {
+                let src = reg_number(*src);
+                self.rex(0, src);
+                self.byte(0xf7);
+                self.modrm(5, src);
+            }
+            Instruction::Cdq => self.byte(0x99),
+            Instruction::Idiv { src } => {
+                let src = reg_number(*src);
+                self.rex(0, src);
+                self.byte(0xf7);
+                self.modrm(7, src);
+            }
+            Instruction::Mov { src, dst } => {
+                let (src, dst) = (reg_number(*src), reg_number(*dst));
+                self.rex(src, dst);
+                self.byte(0x89);
+                self.modrm(src, dst);
+            }
+            Instruction::Ret => self.byte(0xc3),
+        }
+    }
+}
+
+/// Append a 16-bit little-endian value.
+fn push_u16(bytes: &mut Vec<u8>, value: u16) {
+    bytes.extend_from_slice(&value.to_le_bytes());
+}
+
+/// Append a 32-bit little-endian value.
+fn push_u32(bytes: &mut Vec<u8>, value: u32) {
+    bytes.extend_from_slice(&value.to_le_bytes());
+}
+
+/// Append a 64-bit little-endian value.
+fn push_u64(bytes: &mut Vec<u8>, value: u64) {
+    bytes.extend_from_slice(&value.to_le_bytes());
+}
+
+/// Pad with zero bytes up to the given alignment.
+fn pad_to(bytes: &mut Vec<u8>, align: usize) {
+    while bytes.len() % align != 0 {
+        bytes.push(0);
+    }
+}
+
+/// Wrap a text section and its symbols into a complete ELF64 relocatable object.
+fn build_elf(code: &[u8], symbols: &[Symbol]) -> Vec<u8> {
+    // The symbol table requires local symbols before global ones; its sh_info field is the index
+    // of the first global.
+    let mut ordered: Vec<&Symbol> = symbols.iter().collect();
+    ordered.sort_by_key(|symbol| symbol.global);
+    let first_global = 1 + ordered.iter().filter(|symbol| !symbol.global).count();
+
+    // String table for symbol names. Index zero is the mandatory empty name.
+    let mut strtab = vec![0u8];
+    let name_offsets: Vec<u32> = ordered
+        .iter()
+        .map(|symbol| {
+            let offset = strtab.len() as u32;
+            strtab.extend_from_slice(symbol.name.as_bytes());
+            strtab.push(0);
+            offset
+        })
+        .collect();
+
+    // Symbol table: the null entry, then one STT_FUNC entry per label.
+    let mut symtab = vec![0u8; 24];
+    for (symbol, &name) in ordered.iter().zip(&name_offsets) {
+        let binding = if symbol.global { 1 } else { 0 }; // STB_GLOBAL / STB_LOCAL
+        push_u32(&mut symtab, name);
+        symtab.push(binding << 4 | 2); // STT_FUNC
+        symtab.push(0);
+        push_u16(&mut symtab, 1); // defined in .text, section index 1
+        push_u64(&mut symtab, symbol.offset);
+        push_u64(&mut symtab, symbol.size);
+    }
+
+    // Section name table. The order here matches the section header order below.
+    let section_names = [".text", ".symtab", ".strtab", ".shstrtab", ".note.GNU-stack"];
+    let mut shstrtab = vec![0u8];
+    let section_name_offsets: Vec<u32> = section_names
+        .iter()
+        .map(|name| {
+            let offset = shstrtab.len() as u32;
+            shstrtab.extend_from_slice(name.as_bytes());
+            shstrtab.push(0);
+            offset
+        })
+        .collect();
+
+    // Lay the file out: ELF header, section contents, then the section header table.
+    let mut object = Vec::with_capacity(512 + code.len());
+    object.resize(64, 0); // ELF header, filled in below
+
+    pad_to(&mut object, 16);
+    let text_offset = object.len();
+    object.extend_from_slice(code);
+
+    pad_to(&mut object, 8);
+    let symtab_offset = object.len();
+    object.extend_from_slice(&symtab);
+
+    let strtab_offset = object.len();
+    object.extend_from_slice(&strtab);
+
+    let shstrtab_offset = object.len();
+    object.extend_from_slice(&shstrtab);
+
+    pad_to(&mut object, 8);
+    let shoff = object.len();
+
+    // Section headers: name, type, flags, addr, offset, size, link, info, align, entsize.
+    let header = |object: &mut Vec<u8>,
+                      name: u32,
+                      kind: u32,
+                      flags: u64,
+                      offset: usize,
+                      size: usize,
+                      link: u32,
+                      info: u32,
+                      align: u64,
+                      entsize: u64| {
+        push_u32(object, name);
+        push_u32(object, kind);
+        push_u64(object, flags);
+        push_u64(object, 0);
+        push_u64(object, offset as u64);
+        push_u64(object, size as u64);
+        push_u32(object, link);
+        push_u32(object, info);
+        push_u64(object, align);
+        push_u64(object, entsize);
+    };
+
+    const SHT_PROGBITS: u32 = 1;
+    const SHT_SYMTAB: u32 = 2;
+    const SHT_STRTAB: u32 = 3;
+    const SHF_ALLOC_EXECINSTR: u64 = 0x6;
+
+    object.extend_from_slice(&[0u8; 64]); // the null section header
+    header(
+        &mut object,
+        section_name_offsets[0],
+        SHT_PROGBITS,
+        SHF_ALLOC_EXECINSTR,
+        text_offset,
+        code.len(),
+        0,
+        0,
+        16,
+        0,
+    );
+    header(
+        &mut object,
+        section_name_offsets[1],
+        SHT_SYMTAB,
+        0,
+        symtab_offset,
+        symtab.len(),
+        3, // names live in .strtab
+        first_global as u32,
+        8,
+        24,
+    );
+    header(
+        &mut object,
+        section_name_offsets[2],
+        SHT_STRTAB,
+        0,
+        strtab_offset,
+        strtab.len(),
+        0,
+        0,
+        1,
+        0,
+    );
+    header(
+        &mut object,
+        section_name_offsets[3],
+        SHT_STRTAB,
+        0,
+        shstrtab_offset,
+        shstrtab.len(),
+        0,
+        0,
+        1,
+        0,
+    );
+    header(
+        &mut object,
+        section_name_offsets[4],
+        SHT_PROGBITS,
+        0,
+        shstrtab_offset + shstrtab.len(),
+        0,
+        0,
+        0,
+        1,
+        0,
+    );
+
+    // Now that every offset is known, fill in the ELF header.
+    let ident = [0x7f, b'E', b'L', b'F', 2, 1, 1, 0]; // 64-bit, little-endian, version 1
+    object[..8].copy_from_slice(&ident);
+
+    let mut ehdr = Vec::with_capacity(48);
+    push_u16(&mut ehdr, 1); // ET_REL
+    push_u16(&mut ehdr, 62); // EM_X86_64
+    push_u32(&mut ehdr, 1); // EV_CURRENT
+    push_u64(&mut ehdr, 0); // no entry point
+    push_u64(&mut ehdr, 0); // no program headers
+    push_u64(&mut ehdr, shoff as u64);
+    push_u32(&mut ehdr, 0); // flags
+    push_u16(&mut ehdr, 64); // ELF header size
+    push_u16(&mut ehdr, 0); // program header entry size
+    push_u16(&mut ehdr, 0); // program header count
+    push_u16(&mut ehdr, 64); // section header entry size
+    push_u16(&mut ehdr, 6); // section header count
+    push_u16(&mut ehdr, 4); // .shstrtab index
+    object[16..64].copy_from_slice(&ehdr);
+
+    object
+}
@@ -0,0 +1,65 @@
+use crate::ast::{self, Expr};
+
+/// Fold constant expressions in a program.
+///
+/// This pass evaluates unary and binary expressions whose operands are integer literals, replacing
+/// them with the literal result. It runs between parsing and codegen, so by the time the compiler
+/// sees the tree, something like `2 + 3 * 4` is just `14` and compiles to a single `movl`.
+///
+/// Because the parser pushes children into the pool before their parents, one forward pass over
+/// the pool folds nested constant expressions all the way up: by the time the pass reaches a
+/// parent, any foldable children have already been rewritten to literals. Folded children are left
+/// behind in the pool as unreferenced nodes, which costs a little memory but saves rebuilding the
+/// pool.
+pub fn fold_program(program: &mut ast::Program) {
+    let exprs = &mut program.exprs;
+
+    for index in 0..exprs.len() {
+        let id = ast::ExprId::from_index(index);
+        let folded = match exprs.get(id) {
+            Expr::Integer(_) => None,
+            Expr::Unary { operator, operand } => fold_unary(operator, exprs.get(operand)),
+            Expr::Binary {
+                operator,
+                left,
+                right,
+            } => fold_binary(operator, exprs.get(left), exprs.get(right)),
+        };
+
+        if let Some(value) = folded {
+            exprs.set(id, Expr::Integer(value));
+        }
+    }
+}
+
+/// Evaluate a unary operation over a literal operand, if possible.
+fn fold_unary(op: ast::UnaryOp, operand: Expr) -> Option<i32> {
+    let Expr::Integer(value) = operand else {
+        return None;
+    };
+
+    match op {
+        ast::UnaryOp::Compliment => Some(!value),
+        ast::UnaryOp::NegateArith => value.checked_neg(),
+        ast::UnaryOp::NegateLogical => Some((value == 0) as i32),
+    }
+}
+
+/// Evaluate a binary operation over literal operands, if possible.
+///
+/// The checked arithmetic here is deliberate: anything that would overflow or divide by zero is
+/// left unfolded, so the generated code keeps whatever behavior the hardware gives it instead of
+/// the pass inventing a value at compile time.
+fn fold_binary(op: ast::BinaryOp, left: Expr, right: Expr) -> Option<i32> {
+    let (Expr::Integer(left), Expr::Integer(right)) = (left, right) else {
+        return None;
+    };
+
+    match op {
+        ast::BinaryOp::Plus => left.checked_add(right),
+        ast::BinaryOp::Minus => left.checked_sub(right),
+        ast::BinaryOp::Times => left.checked_mul(right),
+        ast::BinaryOp::Divide => left.checked_div(right),
+        ast::BinaryOp::Mod => left.checked_rem(right),
+    }
+}
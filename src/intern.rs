@@ -0,0 +1,70 @@
+use std::collections::HashMap;
+
+/// An interned identifier.
+///
+/// A symbol is a dense `u32` handle into an [`Interner`], in the same spirit as
+/// [`crate::ast::ExprId`]: every occurrence of the same identifier text maps to the same symbol,
+/// so comparing two identifiers anywhere after the parser is an integer compare rather than a
+/// byte-by-byte string walk, and passing one around copies four bytes instead of cloning a heap
+/// string. The text itself is only looked back up when a name has to be written out (assembly
+/// labels, object file symbols, diagnostics).
+#[derive(Clone, Copy, PartialEq, Eq, Hash, Debug)]
+pub struct Symbol(u32);
+
+impl Symbol {
+    /// Create a symbol from a raw index.
+    pub fn from_index(index: usize) -> Self {
+        Self(index as u32)
+    }
+
+    /// The raw index of this symbol.
+    pub fn index(self) -> usize {
+        self.0 as usize
+    }
+}
+
+/// The table mapping identifier text to symbols and back.
+///
+/// Each distinct identifier is stored once, the first time it is seen; every later occurrence
+/// costs one hash lookup and allocates nothing. Symbols are handed out densely from zero, so later
+/// phases can index plain vectors by symbol the way they already do by [`crate::ir::TempId`].
+#[derive(Clone, Debug, Default)]
+pub struct Interner {
+    map: HashMap<String, Symbol>,
+    strings: Vec<String>,
+}
+
+impl Interner {
+    /// Create an empty interner.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// The symbol for the given identifier text, allocating one if it is new.
+    pub fn intern(&mut self, text: &str) -> Symbol {
+        if let Some(&symbol) = self.map.get(text) {
+            return symbol;
+        }
+
+        let symbol = Symbol::from_index(self.strings.len());
+        self.strings.push(text.to_owned());
+        self.map.insert(text.to_owned(), symbol);
+
+        symbol
+    }
+
+    /// The text of an interned symbol.
+    pub fn resolve(&self, symbol: Symbol) -> &str {
+        &self.strings[symbol.index()]
+    }
+
+    /// How many distinct identifiers have been interned.
+    pub fn len(&self) -> usize {
+        self.strings.len()
+    }
+
+    /// Return true if nothing has been interned.
+    pub fn is_empty(&self) -> bool {
+        self.strings.is_empty()
+    }
+}
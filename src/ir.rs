@@ -0,0 +1,202 @@
+use crate::ast;
+use crate::intern::{Interner, Symbol};
+
+/// A handle to a temporary in an [`Function`]'s virtual register space.
+///
+/// Temporaries are numbered densely from zero within their function, so backends can use plain
+/// vectors indexed by temp id instead of maps.
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub struct TempId(u32);
+
+impl TempId {
+    /// Create a temp id from a raw index.
+    pub fn from_index(index: usize) -> Self {
+        Self(index as u32)
+    }
+
+    /// The raw index of this temp id.
+    pub fn index(self) -> usize {
+        self.0 as usize
+    }
+}
+
+/// An operand of an IR instruction: either a constant or the value of a temporary.
+#[derive(Clone, Copy, Debug)]
+pub enum Value {
+    /// An integer constant.
+    Constant(i32),
+
+    /// The value produced into a temporary by an earlier instruction.
+    Temp(TempId),
+}
+
+/// A single three-address instruction.
+///
+/// Every instruction names its operands and destination explicitly, so passes over the IR never
+/// need to reconstruct evaluation order or chase a tree: a function is just a flat vector of
+/// these, iterated front to back.
+#[derive(Clone, Copy, Debug)]
+pub enum Instruction {
+    /// `dst = op src`.
+    Unary {
+        op: ast::UnaryOp,
+        src: Value,
+        dst: TempId,
+    },
+
+    /// `dst = left op right`.
+    Binary {
+        op: ast::BinaryOp,
+        left: Value,
+        right: Value,
+        dst: TempId,
+    },
+
+    /// Return a value from the function.
+    Return(Value),
+}
+
+/// A function lowered to three-address form.
+#[derive(Clone, Debug)]
+pub struct Function {
+    /// The function's name, interned in the program's [`Interner`].
+    pub name: Symbol,
+
+    /// The function's body as a flat instruction vector.
+    pub instructions: Vec<Instruction>,
+
+    /// How many temporaries the instructions reference. Ids run from 0 to this, exclusive.
+    pub temp_count: u32,
+}
+
+/// A whole program in three-address form, mirroring [`ast::Program`].
+#[derive(Clone, Debug)]
+pub struct Program {
+    /// The functions of the program, in source order.
+    pub functions: Vec<Function>,
+
+    /// The interner the function names live in, carried over from the front end so the backend
+    /// can render names when it writes labels and object file symbols.
+    pub symbols: Interner,
+}
+
+/// Lower an abstract syntax tree into three-address form.
+///
+/// This is the seam between the front end and the back end: everything after this point works on
+/// flat instruction vectors, so optimization passes iterate linearly over contiguous memory
+/// instead of recursing through the expression pool, and instruction selection never sees the AST
+/// at all.
+pub fn lower_program(program: &ast::Program) -> Program {
+    Program {
+        functions: program
+            .functions
+            .iter()
+            .map(|function| lower_function(&program.exprs, function))
+            .collect(),
+        symbols: program.symbols.clone(),
+    }
+}
+
+/// Lower a single function.
+fn lower_function(exprs: &ast::ExprPool, function: &ast::Function) -> Function {
+    let mut lowerer = Lowerer {
+        exprs,
+        instructions: Vec::new(),
+        temp_count: 0,
+    };
+
+    for statement in &function.body {
+        match statement {
+            ast::Statement::Return(expr) => {
+                let value = lowerer.lower_expression(*expr);
+                lowerer.instructions.push(Instruction::Return(value));
+            }
+        }
+    }
+
+    Function {
+        name: function.name,
+        instructions: lowerer.instructions,
+        temp_count: lowerer.temp_count,
+    }
+}
+
+/// The state threaded through lowering one function.
+struct Lowerer<'a> {
+    exprs: &'a ast::ExprPool,
+    instructions: Vec<Instruction>,
+    temp_count: u32,
+}
+
+impl Lowerer<'_> {
+    /// Hand out the next unused temporary.
+    fn fresh_temp(&mut self) -> TempId {
+        let temp = TempId(self.temp_count);
+        self.temp_count += 1;
+        temp
+    }
+
+    /// Lower an expression, returning the value that holds its result.
+    ///
+    /// Integer literals lower to constants rather than temporaries, so instruction selection can
+    /// see them directly and use immediate operand forms.
+    ///
+    /// The tree is walked in post order with an explicit work stack and a value stack instead of
+    /// recursion, so arbitrarily deep machine-generated expressions lower in heap memory rather
+    /// than thread stack. A work item is revisited once its children have produced their values;
+    /// children are pushed left-last so the left operand is lowered (and its instructions
+    /// emitted) first, keeping the instruction order identical to the old recursive walk.
+    fn lower_expression(&mut self, root: ast::ExprId) -> Value {
+        let mut work = vec![(root, false)];
+        let mut values: Vec<Value> = Vec::new();
+
+        while let Some((expr, ready)) = work.pop() {
+            match self.exprs.get(expr) {
+                ast::Expr::Integer(value) => values.push(Value::Constant(value)),
+                ast::Expr::Unary { operator, operand } => {
+                    if !ready {
+                        work.push((expr, true));
+                        work.push((operand, false));
+                        continue;
+                    }
+
+                    let src = values.pop().unwrap();
+                    let dst = self.fresh_temp();
+                    self.instructions.push(Instruction::Unary {
+                        op: operator,
+                        src,
+                        dst,
+                    });
+
+                    values.push(Value::Temp(dst));
+                }
+                ast::Expr::Binary {
+                    operator,
+                    left,
+                    right,
+                } => {
+                    if !ready {
+                        work.push((expr, true));
+                        work.push((right, false));
+                        work.push((left, false));
+                        continue;
+                    }
+
+                    let right = values.pop().unwrap();
+                    let left = values.pop().unwrap();
+                    let dst = self.fresh_temp();
+                    self.instructions.push(Instruction::Binary {
+                        op: operator,
+                        left,
+                        right,
+                        dst,
+                    });
+
+                    values.push(Value::Temp(dst));
+                }
+            }
+        }
+
+        values.pop().unwrap()
+    }
+}
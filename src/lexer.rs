@@ -6,54 +6,240 @@ use crate::token::check_keyword;
 ///
 /// This function lexes a string of C source code into individual tokens. If the source code is not
 /// ascii, you will get some very strange results.
+///
+/// This is a convenience wrapper that collects the whole token stream into a vector. If you are
+/// going to consume the tokens one at a time anyway (like the parser does), prefer iterating over
+/// a [`Lexer`] directly so the tokens never need to be buffered.
 pub fn tokenize(source: &str) -> Vec<Token> {
+    Lexer::new(source).collect()
+}
+
+/// Tokenize a string of source code into a structure-of-arrays stream.
+///
+/// Like [`tokenize`], but the result is a [`crate::token::TokenStream`], which is the layout to
+/// reach for when a buffered token sequence is going to be scanned or kept around.
+pub fn tokenize_stream(source: &str) -> crate::token::TokenStream {
+    Lexer::new(source).collect()
+}
+
+/// The smallest chunk worth handing to its own lexer thread.
+///
+/// Below roughly a megabyte per worker the thread spawn and stitch overhead eats the win, so
+/// [`tokenize_parallel`] sizes its chunk count by this and falls back to the serial lexer when the
+/// input cannot fill at least two chunks.
+pub const PARALLEL_CHUNK_MIN: usize = 1 << 20;
+
+/// Tokenize a large source in parallel chunks.
+///
+/// The source is split just past newlines, which in this language is always between tokens: no
+/// token or `//` comment spans a newline, so each chunk lexes to exactly the tokens the serial
+/// lexer would have produced for that region. One worker runs a chunk-local [`Lexer`] per chunk,
+/// and the chunk streams are stitched back together in file order with their byte offsets and
+/// line numbers rebased. Throughput on big generated files scales with core count; small inputs
+/// take the serial path untouched.
+pub fn tokenize_parallel(source: &str) -> crate::token::TokenStream {
+    let worker_count = std::thread::available_parallelism()
+        .map(|n| n.get())
+        .unwrap_or(1);
+
+    let chunk_count = worker_count.min(source.len() / PARALLEL_CHUNK_MIN);
+    if chunk_count < 2 {
+        return tokenize_stream(source);
+    }
+
+    // Chunk boundaries land one byte past a newline near each even split point. The resulting
+    // start list is non-decreasing (a long line can push consecutive targets onto the same
+    // newline), so deduping leaves strictly increasing starts.
     let bytes = source.as_bytes();
-    let mut lexer = Lexer::new(bytes);
-    let mut tokens = Vec::new();
+    let mut starts = vec![0];
+    for i in 1..chunk_count {
+        let target = i * bytes.len() / chunk_count;
+        match memchr::memchr(b'\n', &bytes[target..]) {
+            Some(j) if target + j + 1 < bytes.len() => starts.push(target + j + 1),
+            _ => break,
+        }
+    }
+    starts.dedup();
+
+    // One worker per chunk. Joining the handles in order hands back the chunk streams in file
+    // order, so stitching is a straight walk down the list.
+    let chunk_results: Vec<(crate::token::TokenStream, usize)> = std::thread::scope(|scope| {
+        let handles: Vec<_> = starts
+            .iter()
+            .enumerate()
+            .map(|(i, &start)| {
+                let end = starts.get(i + 1).copied().unwrap_or(source.len());
+                let chunk = &source[start..end];
+                scope.spawn(move || {
+                    let mut lexer = Lexer::new(chunk);
+                    let stream: crate::token::TokenStream = lexer.by_ref().collect();
+
+                    // Every newline lives in whitespace, so the drained lexer's newline index
+                    // has recorded each one; that gives the line count this chunk contributes.
+                    (stream, lexer.line_starts.len() - 1)
+                })
+            })
+            .collect();
+
+        handles.into_iter().map(|h| h.join().unwrap()).collect()
+    });
+
+    let mut stream = crate::token::TokenStream::new();
+    let mut line_base = 0;
+    for (i, (chunk_stream, newline_count)) in chunk_results.iter().enumerate() {
+        stream.append_shifted(chunk_stream, starts[i] as u32, line_base);
+        line_base += *newline_count as u32;
+    }
+
+    stream
+}
+
+/// A table of line-start byte offsets for resolving source positions.
+///
+/// Diagnostics used to find their line by scanning the whole file per error, which turns a build
+/// with many errors into many full passes over the source. The table is built in a single
+/// `memchr` sweep instead and is shared by every diagnostic in a compile: a byte offset resolves
+/// to its line by binary search, and a line's text is sliced straight out of the source between
+/// two table entries.
+pub struct LineIndex {
+    line_starts: Vec<usize>,
+}
+
+impl LineIndex {
+    /// Build the table with one pass over the source.
+    pub fn new(source: &str) -> Self {
+        let mut line_starts = vec![0];
+        for i in memchr::memchr_iter(b'\n', source.as_bytes()) {
+            line_starts.push(i + 1);
+        }
+
+        Self { line_starts }
+    }
+
+    /// Resolve a byte offset to its 1-based line and column by binary search.
+    pub fn position(&self, offset: usize) -> (usize, usize) {
+        let line = self.line_starts.partition_point(|&start| start <= offset);
+        (line, offset - self.line_starts[line - 1] + 1)
+    }
+
+    /// The text of the given 1-based line, without its trailing newline.
+    pub fn line_text<'a>(&self, source: &'a str, line: usize) -> &'a str {
+        let start = self.line_starts[line - 1];
+        let end = match self.line_starts.get(line) {
+            Some(&next) => next - 1,
+            None => source.len(),
+        };
+
+        &source[start..end]
+    }
+}
+
+/// Character class bit for whitespace bytes.
+const CLASS_WHITESPACE: u8 = 1 << 0;
+
+/// Character class bit for decimal digits.
+const CLASS_DIGIT: u8 = 1 << 1;
+
+/// Character class bit for bytes that can start an identifier (letters and underscore).
+const CLASS_IDENT_START: u8 = 1 << 2;
+
+/// Character class bit for bytes that can continue an identifier.
+const CLASS_IDENT: u8 = 1 << 3;
+
+/// Build the 256-entry classification table at compile time.
+///
+/// One table lookup classifies a byte for every question the lexer ever asks about it, which is
+/// what lets the scanning kernels below run as tight, branch-predictable loops over whole runs of
+/// bytes instead of re-deciding "is this a digit? a letter? whitespace?" per character.
+const fn build_class_table() -> [u8; 256] {
+    let mut table = [0u8; 256];
+    let mut c = 0;
+
+    while c < 256 {
+        let byte = c as u8;
+        let mut class = 0;
+
+        if matches!(byte, b' ' | b'\t' | b'\n' | b'\r' | 0x0b | 0x0c) {
+            class |= CLASS_WHITESPACE;
+        }
+
+        if byte.is_ascii_digit() {
+            class |= CLASS_DIGIT | CLASS_IDENT;
+        }
+
+        if byte.is_ascii_alphabetic() || byte == b'_' {
+            class |= CLASS_IDENT_START | CLASS_IDENT;
+        }
 
-    while let Some(token) = lexer.next_token() {
-        tokens.push(token);
+        table[c] = class;
+        c += 1;
     }
 
-    tokens
+    table
 }
 
-struct Lexer<'a> {
+static CLASS_TABLE: [u8; 256] = build_class_table();
+
+/// The lexer.
+///
+/// A lexer walks a string of source code and hands out one [`Token`] at a time through its
+/// [`Iterator`] implementation. Since tokens are produced on demand, lexing a file takes constant
+/// memory no matter how big it is, and a consumer like the parser can overlap its own work with
+/// tokenization in a single pass over the source.
+///
+/// Runs of whitespace, identifier, and digit bytes are consumed by [`Lexer::scan_while`], a
+/// chunked kernel over the classification table, rather than one `peek`/`advance` step per byte.
+/// Line and column information is not tracked per character either: the lexer keeps an index of
+/// newline offsets (newlines only ever occur between tokens, so the whitespace skipper sees every
+/// one of them) and derives a token's position from that index in O(1) when the token is made.
+pub struct Lexer<'a> {
     source: &'a [u8],
     current: usize,
-    line: usize,
-    column: usize,
+    line_starts: Vec<usize>,
 }
 
 impl<'a> Lexer<'a> {
     /// Construct a lexer.
     ///
     /// This constructor initializes the source view to the given string, setting the current
-    /// character index to the beginning of the string and the line and column to 1.
-    fn new(source: &'a [u8]) -> Self {
+    /// character index to the beginning of the string. The newline index starts out holding just
+    /// the start of line one.
+    pub fn new(source: &'a str) -> Self {
         Self {
-            source,
+            source: source.as_bytes(),
             current: 0,
-            line: 1,
-            column: 1,
+            line_starts: vec![0],
         }
     }
 
     /// Return true if the given character could be the start of an identifier. This includes
     /// uppercase and lowercase alphabetic characters and underscores.
     fn is_ident_start(c: u8) -> bool {
-        (b'A' <= c && c <= b'Z') || (b'a' <= c && c <= b'z') || c == b'_'
+        CLASS_TABLE[c as usize] & CLASS_IDENT_START != 0
     }
 
     /// Return true if the given character could be in the middle of an identifier. This includes
     /// every character from `is_ident_start` as well as numeric characters.
     fn is_ident(c: u8) -> bool {
-        Self::is_ident_start(c) || Self::is_digit(c)
+        CLASS_TABLE[c as usize] & CLASS_IDENT != 0
     }
 
     /// Return true if the given character is a digit, e.g. '0' to '9'.
     fn is_digit(c: u8) -> bool {
-        b'0' <= c && c <= b'9'
+        CLASS_TABLE[c as usize] & CLASS_DIGIT != 0
+    }
+
+    /// The line (1-based) that the lexer is currently on.
+    fn line(&self) -> usize {
+        self.line_starts.len()
+    }
+
+    /// The column (1-based) of the given offset on the current line.
+    fn column_of(&self, offset: usize) -> usize {
+        // The newline index always has at least one entry and never one past `offset`, because
+        // every newline before the current token was consumed (and recorded) by the whitespace
+        // skipper before the token started.
+        offset - self.line_starts.last().copied().unwrap() + 1
     }
 
     /// Get the current character.
@@ -74,39 +260,64 @@ impl<'a> Lexer<'a> {
     /// is performed and [`None`] is returned.
     fn advance(&mut self) -> Option<u8> {
         let current = self.peek();
-        if let Some(current) = current {
+        if current.is_some() {
             self.current += 1;
-            self.column += 1;
+        }
+
+        current
+    }
 
-            if current == b'\n' {
-                self.line += 1;
-                self.column = 1;
+    /// Find the end of the run of bytes matching `class` that starts at `start`.
+    ///
+    /// This is the lexer's scanning kernel. The inner loop classifies a fixed 16-byte chunk at a
+    /// time, which the compiler is free to unroll and vectorize, so long whitespace runs,
+    /// identifiers, and digit strings cost a fraction of the old byte-at-a-time walk. The scalar
+    /// loop at the end just mops up the tail of the file.
+    fn scan_while(&self, start: usize, class: u8) -> usize {
+        let bytes = self.source;
+        let mut pos = start;
+
+        while pos + 16 <= bytes.len() {
+            let chunk = &bytes[pos..pos + 16];
+            match chunk
+                .iter()
+                .position(|&c| CLASS_TABLE[c as usize] & class == 0)
+            {
+                Some(i) => return pos + i,
+                None => pos += 16,
             }
         }
 
-        current
+        while pos < bytes.len() && CLASS_TABLE[bytes[pos] as usize] & class != 0 {
+            pos += 1;
+        }
+
+        pos
+    }
+
+    /// Record every newline in `source[start..end]` in the newline index.
+    fn note_newlines(&mut self, start: usize, end: usize) {
+        for i in memchr::memchr_iter(b'\n', &self.source[start..end]) {
+            self.line_starts.push(start + i + 1);
+        }
     }
 
     /// Skip past any whitespace and comments.
     ///
-    /// This method advances the position of the lexer until the current character is not a
-    /// whitespace character. If the next non-whitespace character is a slash followed by another
-    /// slash, the comment will be skipped. Naturally, if that was already the case when the method
-    /// was called, the lexer's state is not altered.
+    /// Whitespace runs are consumed with the chunked kernel and their newlines logged into the
+    /// newline index in one pass; `//` comments are skipped by jumping straight to the next
+    /// newline with `memchr` (the newline itself is left for the following whitespace run, so it
+    /// still gets recorded).
     fn skip_whitespace(&mut self) {
-        while let Some(c) = self.peek() {
-            if c.is_ascii_whitespace() {
-                self.advance();
-                continue;
-            }
-
-            if c == b'/'
-                && let Some(b'/') = self.peek_next()
-            {
-                while let Some(c) = self.peek()
-                    && c != b'\n'
-                {
-                    self.advance();
+        loop {
+            let run_end = self.scan_while(self.current, CLASS_WHITESPACE);
+            self.note_newlines(self.current, run_end);
+            self.current = run_end;
+
+            if self.peek() == Some(b'/') && self.peek_next() == Some(b'/') {
+                match memchr::memchr(b'\n', &self.source[self.current..]) {
+                    Some(i) => self.current += i,
+                    None => self.current = self.source.len(),
                 }
             } else {
                 break;
@@ -116,21 +327,21 @@ impl<'a> Lexer<'a> {
 
     /// Make a token of the given type and advance.
     ///
-    /// This method constructs a token with the given type, taking the line and column information
-    /// from the lexer. The token is assumed to be one character long, so a single character
-    /// substring is taken from the source.
+    /// This method constructs a token with the given type, deriving the line and column
+    /// information from the newline index. The token is assumed to be one character long, so its
+    /// span covers a single byte of the source.
     ///
     /// NOTE: This method is marked `#[must_use]`. If you just want to advance the lexer, use
     /// `advance`.
     #[must_use]
     fn make_token_and_advance(&mut self, kind: TokenKind) -> Token {
-        let bytes = &self.source[self.current..self.current + 1];
-        let lexeme = str::from_utf8(bytes).unwrap().to_string();
         let token = Token {
             kind,
-            lexeme,
-            line: self.line,
-            column: self.column,
+            offset: self.current as u32,
+            length: 1,
+            line: self.line() as u32,
+            column: self.column_of(self.current) as u32,
+            value: 0,
         };
 
         self.advance();
@@ -152,57 +363,59 @@ impl<'a> Lexer<'a> {
         }
 
         let start = self.current;
-        let column = self.column;
-        let mut length = 1;
-
-        self.advance();
+        let end = self.scan_while(start + 1, CLASS_IDENT);
+        self.current = end;
 
-        while let Some(current) = self.peek()
-            && Self::is_ident(current)
-        {
-            length += 1;
-            self.advance();
-        }
-
-        let lexeme = str::from_utf8(&self.source[start..start + length]).unwrap();
-        let kind = check_keyword(lexeme);
+        let kind = check_keyword(&self.source[start..end]);
 
         Token {
             kind,
-            lexeme: lexeme.to_owned(),
-            line: self.line,
-            column,
+            offset: start as u32,
+            length: (end - start) as u32,
+            line: self.line() as u32,
+            column: self.column_of(start) as u32,
+            value: 0,
         }
     }
 
     /// Consume the next number from the source.
+    ///
+    /// The literal's value is computed right here, while its digits are still hot in cache from
+    /// the scan, and stored in the token's payload so the parser never has to revisit the text.
+    /// A literal that overflows an `i32` becomes an error token; the parser reports it like any
+    /// other malformed input instead of the old behavior of panicking on the re-parse.
     fn make_number(&mut self) -> Token {
         let Some(true) = self.peek().map(Self::is_digit) else {
             panic!("expected a digit");
         };
 
         let start = self.current;
-        let column = self.column;
-        let mut length = 1;
-
-        self.advance();
-
-        while let Some(current) = self.peek()
-            && Self::is_digit(current)
-        {
-            length += 1;
-            self.advance();
+        let end = self.scan_while(start + 1, CLASS_DIGIT);
+        self.current = end;
+
+        let mut kind = TokenKind::LiteralInteger;
+        let mut value: i32 = 0;
+        for &digit in &self.source[start..end] {
+            match value
+                .checked_mul(10)
+                .and_then(|v| v.checked_add((digit - b'0') as i32))
+            {
+                Some(v) => value = v,
+                None => {
+                    kind = TokenKind::SpecialError;
+                    value = 0;
+                    break;
+                }
+            }
         }
 
-        let lexeme = str::from_utf8(&self.source[start..start + length])
-            .unwrap()
-            .to_owned();
-
         Token {
-            kind: TokenKind::LiteralInteger,
-            lexeme,
-            line: self.line,
-            column: column,
+            kind,
+            offset: start as u32,
+            length: (end - start) as u32,
+            line: self.line() as u32,
+            column: self.column_of(start) as u32,
+            value,
         }
     }
 
@@ -242,3 +455,11 @@ impl<'a> Lexer<'a> {
         Some(token)
     }
 }
+
+impl Iterator for Lexer<'_> {
+    type Item = Token;
+
+    fn next(&mut self) -> Option<Token> {
+        self.next_token()
+    }
+}
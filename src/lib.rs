@@ -2,109 +2,625 @@
 #![allow(dead_code)]
 
 use std::ffi::OsStr;
+use std::hash::{Hash, Hasher};
 use std::io::Write;
-use std::path::Path;
+use std::path::{Path, PathBuf};
 use std::process::Command;
 
 use crate::parser::ParseError;
 use crate::token::Token;
 
 pub mod ast;
+pub mod astfile;
 pub mod compiler;
+pub mod daemon;
+pub mod elf;
+pub mod fold;
+pub mod intern;
+pub mod ir;
 pub mod lexer;
 pub mod parser;
+pub mod preprocess;
+pub mod timing;
 pub mod token;
 
+/// An error from compiling one translation unit.
+///
+/// Everything the pipeline can trip over is funneled into this one type so the `try_` family of
+/// entry points below can be embedded in a long-lived host process: nothing on those paths exits,
+/// panics on bad input, or prints on its own. The command line wrappers are the only place these
+/// turn into diagnostics and exit codes.
+#[derive(Debug)]
+pub enum CompileError {
+    /// The source file could not be opened or read.
+    Io(std::io::Error),
+
+    /// The source file was not valid UTF-8.
+    InvalidUtf8,
+
+    /// The source failed to parse. Rendering the errors against the source is left to the
+    /// caller, since tokens only carry spans. For a file with includes, the spans refer to the
+    /// expanded translation unit.
+    Parse(Vec<ParseError>),
+
+    /// An `#include` directive was malformed, unresolvable, or cyclic.
+    Preprocess(String),
+
+    /// A serialized AST file could not be loaded.
+    AstFile(astfile::FormatError),
+
+    /// The linker ran and failed; whatever it wrote to standard error is kept for reporting.
+    Link(String),
+}
+
+impl std::fmt::Display for CompileError {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            Self::Io(error) => write!(f, "{error}"),
+            Self::InvalidUtf8 => write!(f, "source file is not valid UTF-8"),
+            Self::Parse(errors) if errors.len() == 1 => write!(f, "1 parse error"),
+            Self::Parse(errors) => write!(f, "{} parse errors", errors.len()),
+            Self::Preprocess(message) => write!(f, "{message}"),
+            Self::AstFile(error) => write!(f, "{error}"),
+            Self::Link(stderr) => write!(f, "linking failed:\n{stderr}"),
+        }
+    }
+}
+
+impl std::error::Error for CompileError {}
+
+impl From<std::io::Error> for CompileError {
+    fn from(error: std::io::Error) -> Self {
+        Self::Io(error)
+    }
+}
+
 /// Run the entire compilation pipeline, taking source code to assembly.
+///
+/// This is the command line flavour: parse errors are printed and the process exits. Embedders
+/// should use [`try_compile_source`].
 pub fn compile_source(source: &str) -> String {
-    let tokens = lexer::tokenize(source);
-    let tree = match parser::parse_token_stream(tokens) {
-        Ok(tree) => tree,
-        Err(e) => {
-            print_parse_error(e, source);
+    match try_compile_source(source) {
+        Ok(assembly) => assembly,
+        Err(error) => {
+            report_source_error(&error, source);
             std::process::exit(1);
         }
-    };
+    }
+}
 
-    compiler::compile_ast(tree)
+/// Lex and parse one source, picking the lexing strategy by input size.
+///
+/// Small files stream tokens straight from the lexer into the parser with no buffering. A file
+/// big enough to fill multiple chunks is tokenized across threads first and the parser consumes
+/// the stitched stream; for the huge generated units that is the difference between lexing on one
+/// core and lexing on all of them.
+fn parse_source(source: &str) -> Result<ast::Program, Vec<ParseError>> {
+    if source.len() >= 2 * lexer::PARALLEL_CHUNK_MIN {
+        let stream = lexer::tokenize_parallel(source);
+        parser::parse_token_stream(source, stream.iter())
+    } else {
+        parser::parse_token_stream(source, lexer::Lexer::new(source))
+    }
+}
+
+/// Run the entire compilation pipeline, taking source code to assembly.
+pub fn try_compile_source(source: &str) -> Result<String, CompileError> {
+    let mut tree = parse_source(source).map_err(CompileError::Parse)?;
+
+    fold::fold_program(&mut tree);
+
+    Ok(compiler::compile_ast(tree))
+}
+
+/// Run the compilation pipeline, taking source code to an ELF relocatable object.
+///
+/// The command line flavour of [`try_compile_source_object`]: parse errors are printed and the
+/// process exits.
+pub fn compile_source_object(source: &str) -> Vec<u8> {
+    match try_compile_source_object(source) {
+        Ok(object) => object,
+        Err(error) => {
+            report_source_error(&error, source);
+            std::process::exit(1);
+        }
+    }
+}
+
+/// Run the compilation pipeline, taking source code to an ELF relocatable object.
+///
+/// This is the path the driver actually links from: encoding machine code ourselves means gcc is
+/// never asked to assemble anything, which on small files was most of the wall time.
+pub fn try_compile_source_object(source: &str) -> Result<Vec<u8>, CompileError> {
+    let mut tree = parse_source(source).map_err(CompileError::Parse)?;
+
+    fold::fold_program(&mut tree);
+
+    Ok(compiler::compile_ast_object(tree))
 }
 
 pub fn compile_and_link<P>(path: P)
+where
+    P: AsRef<Path>,
+{
+    compile_and_link_with_cache(path, None);
+}
+
+/// Like [`compile_and_link`], but optionally backed by an on-disk object cache.
+///
+/// When a cache directory is given, the compiled object is stored there under a hash of the
+/// source contents (salted with the compiler version), and a later compile of byte-identical
+/// input skips lexing, parsing, and codegen entirely and goes straight to the link. Our CI
+/// rebuilds the same generated files constantly, so pointing every invocation at a shared
+/// directory turns most compiles into a single file read.
+pub fn compile_and_link_with_cache<P>(path: P, cache_dir: Option<&Path>)
+where
+    P: AsRef<Path>,
+{
+    let path = path.as_ref();
+    if let Err(error) = try_compile_and_link_with_cache(path, cache_dir) {
+        report_file_error(&error, path);
+        std::process::exit(1);
+    }
+}
+
+/// Compile and link a source file, reporting failure through the return value.
+///
+/// This is the entry point for embedding: a build orchestrator can keep one warm ecc resident
+/// and push thousands of files through here, and a broken file comes back as a [`CompileError`]
+/// instead of taking the host process down.
+pub fn try_compile_and_link_with_cache<P>(path: P, cache_dir: Option<&Path>) -> Result<(), CompileError>
+where
+    P: AsRef<Path>,
+{
+    let path = path.as_ref();
+    let mapped = map_source(path)?;
+    let directory = path.parent().unwrap_or(Path::new("."));
+    let object = compile_object_cached(&mapped, directory, cache_dir)?;
+
+    link_object(&object, &path.with_extension(""))
+}
+
+/// Compile a source file to a relocatable object on disk without linking, like gcc's `-c`.
+///
+/// The command line flavour of [`try_compile_object_with_cache`]: errors are printed and the
+/// process exits.
+pub fn compile_object_with_cache<P>(path: P, cache_dir: Option<&Path>)
+where
+    P: AsRef<Path>,
+{
+    let path = path.as_ref();
+    if let Err(error) = try_compile_object_with_cache(path, cache_dir) {
+        report_file_error(&error, path);
+        std::process::exit(1);
+    }
+}
+
+/// Compile a source file to a relocatable object on disk without linking, like gcc's `-c`.
+///
+/// The object lands next to the source with an `.o` extension. Nothing here ever spawns a
+/// subprocess, so this is the fastest path through the compiler.
+pub fn try_compile_object_with_cache<P>(path: P, cache_dir: Option<&Path>) -> Result<(), CompileError>
+where
+    P: AsRef<Path>,
+{
+    let path = path.as_ref();
+    let mapped = map_source(path)?;
+    let directory = path.parent().unwrap_or(Path::new("."));
+    let object = compile_object_cached(&mapped, directory, cache_dir)?;
+
+    std::fs::write(path.with_extension("o"), object)?;
+
+    Ok(())
+}
+
+/// Run only the front end of the pipeline and write the tree out as a binary AST file.
+///
+/// The command line flavour of [`try_emit_ast`], behind `--emit-ast`: errors are printed and the
+/// process exits.
+pub fn emit_ast<P>(path: P)
+where
+    P: AsRef<Path>,
+{
+    let path = path.as_ref();
+    if let Err(error) = try_emit_ast(path) {
+        report_file_error(&error, path);
+        std::process::exit(1);
+    }
+}
+
+/// Run only the front end of the pipeline and write the tree out as a binary AST file.
+///
+/// The file lands next to the source with an `.ast` extension and holds the parsed (and folded)
+/// tree in the flat format of [`astfile`], ready to be handed to [`compile_ast_file`] or any
+/// other consumer of the front end's output as many times as wanted.
+pub fn try_emit_ast<P>(path: P) -> Result<(), CompileError>
+where
+    P: AsRef<Path>,
+{
+    let path = path.as_ref();
+    let mapped = map_source(path)?;
+    let directory = path.parent().unwrap_or(Path::new("."));
+
+    let mut tree = if memchr::memchr(b'#', mapped.as_bytes()).is_some() {
+        let expanded = preprocess::preprocess(&mapped, directory)?;
+        parser::parse_token_stream(&expanded.source, expanded.stream.iter())
+            .map_err(CompileError::Parse)?
+    } else {
+        parse_source(&mapped).map_err(CompileError::Parse)?
+    };
+
+    fold::fold_program(&mut tree);
+
+    std::fs::write(path.with_extension("ast"), astfile::serialize(&tree))?;
+
+    Ok(())
+}
+
+/// Compile and link starting from a binary AST file, skipping the front end entirely.
+///
+/// The command line flavour of [`try_compile_ast_file`]: errors are printed and the process
+/// exits. The driver routes `.ast` inputs here.
+pub fn compile_ast_file<P>(path: P)
 where
     P: AsRef<Path>,
 {
     let path = path.as_ref();
-    let source = std::fs::read_to_string(path).unwrap();
-    let assembly = compile_source(&source);
-    let assembly_file = path.with_extension("s");
-
-    std::fs::write(assembly_file.clone(), assembly).unwrap();
-    let result = link_program(&assembly_file);
-    std::fs::remove_file(assembly_file).unwrap();
-    if !result {
+    if let Err(error) = try_compile_ast_file(path) {
+        report_file_error(&error, path);
         std::process::exit(1);
     }
 }
 
-/// Run `gcc` on the given assembly file.
+/// Compile and link starting from a binary AST file, skipping the front end entirely.
 ///
-/// Since I do not really feel like writing my own linker and standard library, it seems like a
-/// natural choice to link the program in this way. The return value indicates whether or not
-/// linking was successful.
-fn link_program<P>(assembly_file: P) -> bool
+/// The file is memory-mapped and its flat sections decoded straight into the tree; no lexing or
+/// parsing happens, so the back end starts in microseconds however big the original source was.
+pub fn try_compile_ast_file<P>(path: P) -> Result<(), CompileError>
 where
     P: AsRef<Path>,
 {
-    let assembly_file = assembly_file.as_ref();
-    let without_extension = assembly_file.with_extension("");
+    let path = path.as_ref();
+    let file = std::fs::File::open(path)?;
+
+    // The same mmap-with-fallback dance as map_source, minus the UTF-8 validation: the format
+    // is binary and astfile checks everything it reads.
+    let buffered;
+    let bytes = match unsafe { memmap2::Mmap::map(&file) } {
+        Ok(mapped) => {
+            buffered = SourceBytes::Mapped(mapped);
+            &buffered
+        }
+        Err(_) => {
+            buffered = SourceBytes::Buffered(std::fs::read(path)?);
+            &buffered
+        }
+    };
+
+    let tree = astfile::deserialize(bytes).map_err(CompileError::AstFile)?;
+    let object = compiler::compile_ast_object(tree);
+
+    link_object(&object, &path.with_extension(""))
+}
+
+/// The bytes of an AST file, mapped when possible.
+enum SourceBytes {
+    Mapped(memmap2::Mmap),
+    Buffered(Vec<u8>),
+}
+
+impl std::ops::Deref for SourceBytes {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match self {
+            Self::Mapped(map) => map,
+            Self::Buffered(bytes) => bytes,
+        }
+    }
+}
+
+/// Print a compile error against source text the caller already holds.
+fn report_source_error(error: &CompileError, source: &str) {
+    match error {
+        CompileError::Parse(errors) => print_parse_errors(errors, source),
+        other => eprintln!("{other}"),
+    }
+}
+
+/// Print a compile error for a file, re-reading it if the diagnostics need the source text.
+fn report_file_error(error: &CompileError, path: &Path) {
+    match error {
+        CompileError::Parse(errors) => match map_source(path) {
+            // Errors from a file with includes carry positions in the expanded translation
+            // unit, so re-expand it (all cache hits by now) to render against.
+            Ok(mapped) => {
+                let directory = path.parent().unwrap_or(Path::new("."));
+                if memchr::memchr(b'#', mapped.as_bytes()).is_some()
+                    && let Ok(expanded) = preprocess::preprocess(&mapped, directory)
+                {
+                    print_parse_errors(errors, &expanded.source);
+                } else {
+                    print_parse_errors(errors, &mapped);
+                }
+            }
+            Err(_) => eprintln!("{error}"),
+        },
+        other => eprintln!("{other}"),
+    }
+}
+
+/// Compile and link a source file with every phase timed, then print the breakdown.
+///
+/// This is the pipeline behind `--time-report`. It deliberately buffers the token stream instead
+/// of streaming it into the parser (there is no other way to time lexing and parsing separately),
+/// and it skips the object cache, since a cache hit would time a file read and call it a compile.
+/// The numbers therefore reflect a full cold build of the file.
+pub fn compile_and_link_timed<P>(path: P)
+where
+    P: AsRef<Path>,
+{
+    let path = path.as_ref();
+    let mut report = timing::TimeReport::new();
+
+    let mapped = match report.phase("read", || map_source(path)) {
+        Ok(mapped) => mapped,
+        Err(error) => {
+            eprintln!("{error}");
+            std::process::exit(1);
+        }
+    };
+    report.count(mapped.len() as u64, "bytes");
+
+    // A file with includes goes through the preprocessor, whose phase covers both the directive
+    // expansion and the lexing (cached headers make those inseparable); plain files keep the
+    // lex phase on its own line.
+    let expanded = if memchr::memchr(b'#', mapped.as_bytes()).is_some() {
+        let directory = path.parent().unwrap_or(Path::new("."));
+        match report.phase("preproc", || preprocess::preprocess(&mapped, directory)) {
+            Ok(expanded) => Some(expanded),
+            Err(error) => {
+                eprintln!("{error}");
+                std::process::exit(1);
+            }
+        }
+    } else {
+        None
+    };
+
+    let source: &str = match &expanded {
+        Some(expanded) => &expanded.source,
+        None => &mapped,
+    };
+
+    let tree = match &expanded {
+        Some(expanded) => {
+            report.count(expanded.stream.len() as u64, "tokens");
+            report.phase("parse", || {
+                parser::parse_token_stream(source, expanded.stream.iter())
+            })
+        }
+        None => {
+            let tokens = report.phase("lex", || lexer::tokenize(source));
+            report.count(tokens.len() as u64, "tokens");
+            report.phase("parse", || {
+                parser::parse_token_stream(source, tokens.iter().copied())
+            })
+        }
+    };
+    let mut tree = match tree {
+        Ok(tree) => tree,
+        Err(e) => {
+            print_parse_errors(&e, source);
+            std::process::exit(1);
+        }
+    };
+    report.count(tree.exprs.len() as u64, "AST nodes");
+
+    report.phase("fold", || fold::fold_program(&mut tree));
+
+    let object = report.phase("codegen", || compiler::compile_ast_object(tree));
+    report.count(object.len() as u64, "object bytes");
+
+    let linked = report.phase("link", || link_object(&object, &path.with_extension("")));
+
+    report.print(&path.display().to_string());
+
+    if let Err(error) = linked {
+        eprintln!("{error}");
+        std::process::exit(1);
+    }
+}
+
+/// Compute the cache key for the given source code.
+///
+/// The compiler version is mixed in so a cache directory can safely outlive an ecc upgrade:
+/// stale entries just stop being found rather than serving assembly from an older compiler.
+fn cache_key(source: &str) -> u64 {
+    let mut hasher = std::hash::DefaultHasher::new();
+    env!("CARGO_PKG_VERSION").hash(&mut hasher);
+    source.hash(&mut hasher);
+    hasher.finish()
+}
+
+/// The cache file that would hold the compiled object for the given source code.
+fn cache_entry(cache_dir: &Path, source: &str) -> PathBuf {
+    cache_dir.join(format!("{:016x}.o", cache_key(source)))
+}
+
+/// Run the compilation pipeline, consulting the object cache first if one is configured.
+///
+/// Includes are expanded before the cache is consulted, so the key covers the header bytes the
+/// translation unit actually saw: editing a header changes the key even though the including
+/// file's text is unchanged.
+///
+/// Cache writes are best effort: a shared cache on a build farm will race, and losing a write
+/// just means someone recompiles. A missing or unreadable entry is treated the same way.
+fn compile_object_cached(
+    source: &str,
+    directory: &Path,
+    cache_dir: Option<&Path>,
+) -> Result<Vec<u8>, CompileError> {
+    let expanded;
+    let (text, stream) = if memchr::memchr(b'#', source.as_bytes()).is_some() {
+        expanded = preprocess::preprocess(source, directory)?;
+        (expanded.source.as_str(), Some(&expanded.stream))
+    } else {
+        (source, None)
+    };
+
+    let Some(cache_dir) = cache_dir else {
+        return compile_text_object(text, stream);
+    };
+
+    let entry = cache_entry(cache_dir, text);
+    if let Ok(object) = std::fs::read(&entry) {
+        return Ok(object);
+    }
+
+    let object = compile_text_object(text, stream)?;
+    if std::fs::create_dir_all(cache_dir).is_ok() {
+        let _ = std::fs::write(&entry, &object);
+    }
+
+    Ok(object)
+}
+
+/// Compile expanded text, consuming a pre-lexed stream when the preprocessor produced one.
+fn compile_text_object(
+    source: &str,
+    stream: Option<&crate::token::TokenStream>,
+) -> Result<Vec<u8>, CompileError> {
+    match stream {
+        Some(stream) => {
+            let mut tree =
+                parser::parse_token_stream(source, stream.iter()).map_err(CompileError::Parse)?;
+
+            fold::fold_program(&mut tree);
+
+            Ok(compiler::compile_ast_object(tree))
+        }
+        None => try_compile_source_object(source),
+    }
+}
+
+/// A source file opened for compilation.
+///
+/// The interesting variant is `Mapped`, which borrows the file's bytes straight out of the page
+/// cache via `mmap` instead of copying them into a heap buffer up front. For our largest
+/// translation units that copy is pure overhead, and mapping also lets the OS page the source in
+/// on demand as the lexer walks it. Mapping can legitimately fail (empty files, weird
+/// filesystems, stdin-style special files), in which case we quietly fall back to an ordinary
+/// buffered read.
+enum SourceFile {
+    Mapped(memmap2::Mmap),
+    Buffered(String),
+}
+
+impl std::ops::Deref for SourceFile {
+    type Target = str;
+
+    fn deref(&self) -> &str {
+        match self {
+            // The map is validated as UTF-8 once in `map_source`, right after mapping.
+            Self::Mapped(map) => unsafe { str::from_utf8_unchecked(map) },
+            Self::Buffered(source) => source,
+        }
+    }
+}
+
+/// Open the given source file without copying its contents if possible.
+fn map_source(path: &Path) -> Result<SourceFile, CompileError> {
+    let file = std::fs::File::open(path)?;
+
+    // Safety: the map is only unsound if the file changes underneath us while we compile it,
+    // which is the same race every compiler accepts when reading source code.
+    match unsafe { memmap2::Mmap::map(&file) } {
+        Ok(map) => {
+            // Validate once so Deref can hand out &str for free afterwards.
+            if str::from_utf8(&map).is_err() {
+                return Err(CompileError::InvalidUtf8);
+            }
+
+            Ok(SourceFile::Mapped(map))
+        }
+        Err(_) => Ok(SourceFile::Buffered(std::fs::read_to_string(path)?)),
+    }
+}
+
+/// Link the given relocatable object into the given output executable.
+///
+/// Since I do not really feel like writing my own linker and standard library, gcc still drives
+/// the final link. The linker wants a real file to read, so the object is parked next to the
+/// output for the duration of the link and removed afterwards. A failed link comes back as
+/// [`CompileError::Link`] carrying gcc's standard error; anything it printed on a successful run
+/// (warnings) is forwarded.
+fn link_object<P>(object: &[u8], output_file: P) -> Result<(), CompileError>
+where
+    P: AsRef<Path>,
+{
+    let output_file = output_file.as_ref();
+    let object_file = output_file.with_extension("o");
+    std::fs::write(&object_file, object)?;
+
     let output = Command::new("gcc")
         .args([
+            object_file.as_os_str(),
             OsStr::new("-o"),
-            without_extension.as_os_str(),
-            assembly_file.as_os_str(),
+            output_file.as_os_str(),
         ])
-        .output()
-        .unwrap();
+        .output();
+
+    let _ = std::fs::remove_file(&object_file);
+    let output = output?;
+
+    if !output.status.success() {
+        return Err(CompileError::Link(
+            String::from_utf8_lossy(&output.stderr).into_owned(),
+        ));
+    }
 
-    std::io::stdout().write_all(&output.stdout).unwrap();
-    std::io::stderr().write_all(&output.stderr).unwrap();
+    let _ = std::io::stdout().write_all(&output.stdout);
+    let _ = std::io::stderr().write_all(&output.stderr);
 
-    output.status.success()
+    Ok(())
 }
 
-/// Print a pretty parse error.
-fn print_parse_error(e: ParseError, source: &str) {
-    match e.token {
-        Some(token) => print_parse_error_at_token(token, &e.message, source),
-        None => print_parse_error_at_eof(&e.message, source),
+/// Print every parse error from a compile, prettily.
+///
+/// The line table is built once with a single pass over the source and shared by all of the
+/// diagnostics, instead of the old scheme of scanning the file from the top to locate the line of
+/// each error.
+fn print_parse_errors(errors: &[ParseError], source: &str) {
+    let index = lexer::LineIndex::new(source);
+    for e in errors {
+        // This is the one place the error's message actually becomes a string.
+        let message = e.kind.to_string();
+        match e.token {
+            Some(token) => print_parse_error_at_token(token, &message, source, &index),
+            None => print_parse_error_at_eof(&message, source, &index),
+        }
     }
 }
 
-fn print_parse_error_at_token(token: Token, message: &str, source: &str) {
+fn print_parse_error_at_token(token: Token, message: &str, source: &str, index: &lexer::LineIndex) {
     eprintln!("message: {message}");
 
-    // The unwrap call here should never fail. This is because the token came from some line in the
-    // source code, so if the lexer did its job correctly, there should exist a line whose number
-    // mathes that of the token.
-    let (_, line) = source
-        .lines()
-        .enumerate()
-        .find(|(number, _)| *number == token.line - 1)
-        .unwrap();
+    let line = index.line_text(source, token.line as usize);
 
-    let space_padding = token.column - 1;
-    let tilde_padding = token.lexeme.len() - 1;
+    let space_padding = token.column as usize - 1;
+    let tilde_padding = token.length as usize - 1;
 
     eprintln!(" {:>4} | {line}", token.line);
     eprintln!("      | {: <space_padding$}^{:~<tilde_padding$}", "", "",);
 }
 
-fn print_parse_error_at_eof(message: &str, source: &str) {
+fn print_parse_error_at_eof(message: &str, source: &str, index: &lexer::LineIndex) {
     eprintln!("message: {}", message);
 
-    let lines = source.lines();
-    let (number, line) = lines.enumerate().last().unwrap();
-    let padding = line.len();
+    let (number, column) = index.position(source.len());
+    let line = index.line_text(source, number);
+    let padding = column - 1;
 
     eprintln!(" {number:>4} | {line}");
     eprintln!("      | {: <padding$}^", "");
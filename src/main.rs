@@ -1,17 +1,135 @@
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+
 use colored::Colorize;
 
 fn main() {
     let mut args = std::env::args();
     let program_name = args.next().unwrap(); // This should never panic
-    let Some(file_name) = args.next() else {
-        eprintln!(
-            "{program_name}: {} {}",
-            "error:".bold().red(),
-            "no input files".bold().white()
-        );
 
+    let mut file_names = Vec::new();
+    let mut cache_dir: Option<PathBuf> = None;
+    let mut compile_only = false;
+    let mut time_report = false;
+    let mut emit_ast = false;
+    let mut daemon_socket: Option<PathBuf> = None;
+
+    while let Some(arg) = args.next() {
+        if arg == "-c" {
+            compile_only = true;
+        } else if arg == "--time-report" {
+            time_report = true;
+        } else if arg == "--emit-ast" {
+            emit_ast = true;
+        } else if arg == "--daemon" {
+            let Some(socket) = args.next() else {
+                report_error(&program_name, "'--daemon' expects a socket path");
+                std::process::exit(1);
+            };
+
+            daemon_socket = Some(PathBuf::from(socket));
+        } else if arg == "--cache-dir" {
+            let Some(dir) = args.next() else {
+                report_error(&program_name, "'--cache-dir' expects a directory");
+                std::process::exit(1);
+            };
+
+            cache_dir = Some(PathBuf::from(dir));
+        } else {
+            file_names.push(arg);
+        }
+    }
+
+    // Daemon mode takes no input files up front; they arrive over the socket, compiled with
+    // whatever other flags the daemon was launched with.
+    if let Some(socket) = daemon_socket {
+        let options = ecc::daemon::DaemonOptions {
+            compile_only,
+            cache_dir: cache_dir.as_deref(),
+        };
+
+        if let Err(error) = ecc::daemon::run(&socket, options) {
+            report_error(&program_name, &error.to_string());
+            std::process::exit(1);
+        }
+
+        return;
+    }
+
+    if file_names.is_empty() {
+        report_error(&program_name, "no input files");
         std::process::exit(1);
+    }
+
+    compile_all(
+        &file_names,
+        cache_dir.as_deref(),
+        compile_only,
+        time_report,
+        emit_ast,
+    );
+}
+
+/// Print a command line error the way the shell tools around us do.
+fn report_error(program_name: &str, message: &str) {
+    eprintln!(
+        "{program_name}: {} {}",
+        "error:".bold().red(),
+        message.bold().white()
+    );
+}
+
+/// Compile every input file, fanning the work out across a thread pool.
+///
+/// Each translation unit is independent, so there is no reason to compile them one after another.
+/// Workers claim files through a shared atomic index, which keeps the pool balanced even when some
+/// files are much bigger than others, and the gcc links run concurrently too. A single file takes
+/// the plain serial path so the common `ecc foo.c` case pays no thread overhead.
+fn compile_all(
+    file_names: &[String],
+    cache_dir: Option<&Path>,
+    compile_only: bool,
+    time_report: bool,
+    emit_ast: bool,
+) {
+    let compile_one = move |file_name: &String, cache_dir: Option<&Path>| {
+        if emit_ast {
+            ecc::emit_ast(file_name);
+        } else if file_name.ends_with(".ast") {
+            ecc::compile_ast_file(file_name);
+        } else if time_report {
+            ecc::compile_and_link_timed(file_name);
+        } else if compile_only {
+            ecc::compile_object_with_cache(file_name, cache_dir);
+        } else {
+            ecc::compile_and_link_with_cache(file_name, cache_dir);
+        }
     };
 
-    ecc::compile_and_link(file_name);
+    if let [file_name] = file_names {
+        compile_one(file_name, cache_dir);
+        return;
+    }
+
+    let worker_count = std::thread::available_parallelism()
+        .map(|n| n.get())
+        .unwrap_or(1)
+        .min(file_names.len());
+
+    let next_file = AtomicUsize::new(0);
+
+    std::thread::scope(|scope| {
+        for _ in 0..worker_count {
+            scope.spawn(|| {
+                loop {
+                    let index = next_file.fetch_add(1, Ordering::Relaxed);
+                    let Some(file_name) = file_names.get(index) else {
+                        break;
+                    };
+
+                    compile_one(file_name, cache_dir);
+                }
+            });
+        }
+    });
 }
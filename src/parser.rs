@@ -1,30 +1,70 @@
 use crate::ast;
+use crate::intern::{Interner, Symbol};
 use crate::token::{Token, TokenKind};
 
 /// An error that can be generated while parsing.
-#[derive(Clone, Debug)]
+///
+/// Note that this type is all `Copy` data; the human-readable message is not rendered until
+/// someone actually formats the error. Error values get constructed on paths that almost always
+/// succeed (`advance_expect` runs for every token the parser matches), so building a heap string
+/// eagerly would mean an allocation per token for messages that are thrown away.
+#[derive(Clone, Copy, Debug)]
 pub struct ParseError {
     pub token: Option<Token>,
-    pub message: String,
+    pub kind: ParseErrorKind,
+}
+
+/// What a parse error is complaining about.
+///
+/// The variants carry just enough to render the message at report time: either the kind of token
+/// that was expected, or a static message for the structural errors.
+#[derive(Clone, Copy, Debug)]
+pub enum ParseErrorKind {
+    /// A token of the given kind was expected.
+    Expected(TokenKind),
+
+    /// Anything else, described by a fixed message.
+    Message(&'static str),
+}
+
+impl From<TokenKind> for ParseErrorKind {
+    fn from(kind: TokenKind) -> Self {
+        Self::Expected(kind)
+    }
+}
+
+impl From<&'static str> for ParseErrorKind {
+    fn from(message: &'static str) -> Self {
+        Self::Message(message)
+    }
+}
+
+impl std::fmt::Display for ParseErrorKind {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            Self::Expected(kind) => write!(f, "expected {kind}"),
+            Self::Message(message) => f.write_str(message),
+        }
+    }
 }
 
 impl ParseError {
     /// Create a new parse error.
-    fn new(token: Option<Token>, message: impl Into<String>) -> Self {
+    fn new(token: Option<Token>, kind: impl Into<ParseErrorKind>) -> Self {
         Self {
             token,
-            message: message.into(),
+            kind: kind.into(),
         }
     }
 
     /// Create a new parse error at the specified token.
-    fn at_token(token: Token, message: impl Into<String>) -> Self {
-        Self::new(Some(token), message)
+    fn at_token(token: Token, kind: impl Into<ParseErrorKind>) -> Self {
+        Self::new(Some(token), kind)
     }
 
     /// Create a new end of file parse error.
-    fn end_of_file(message: impl Into<String>) -> Self {
-        Self::new(None, message)
+    fn end_of_file(kind: impl Into<ParseErrorKind>) -> Self {
+        Self::new(None, kind)
     }
 }
 
@@ -32,12 +72,21 @@ impl ParseError {
 pub type ParseResult<T> = Result<T, ParseError>;
 
 /// Parse a stream of tokens into a program.
-pub fn parse_token_stream<T>(stream: T) -> ParseResult<ast::Program>
+///
+/// The source code the tokens were lexed from must be passed in as well, since tokens only carry
+/// spans and the parser occasionally needs the actual text (identifier names, integer literals).
+///
+/// The stream is pulled from one token at a time with a single token of lookahead, so passing a
+/// [`crate::lexer::Lexer`] here runs lexing and parsing as one streaming pass over the source,
+/// without ever buffering the whole token stream in memory.
+///
+/// The parser recovers at function boundaries after an error, so a broken file yields every
+/// error it contains in one compile rather than one error per run of the fix-compile loop.
+pub fn parse_token_stream<T>(source: &str, stream: T) -> Result<ast::Program, Vec<ParseError>>
 where
     T: IntoIterator<Item = Token>,
 {
-    let tokens: Vec<_> = stream.into_iter().collect();
-    let mut parser = Parser::new(tokens);
+    let mut parser = Parser::new(source, stream.into_iter());
 
     parser.parse_program()
 }
@@ -76,72 +125,149 @@ fn get_infix_precedence(kind: TokenKind) -> Precedence {
     }
 }
 
+/// A suspended operation on the expression parser's explicit stack.
+///
+/// Each variant stands in for a recursive call the old parser would have had live on the thread
+/// stack: an open parenthesis waiting for its `)`, a prefix operator waiting for its operand, or
+/// a binary operator holding its left-hand side while the right is parsed.
+enum Pending {
+    /// An open parenthesis; the operand finishes when the matching `)` arrives.
+    Group,
+
+    /// A prefix operator waiting to wrap its operand.
+    Unary(ast::UnaryOp),
+
+    /// A binary operator that has its left-hand side and is waiting on the right.
+    Binary(ast::BinaryOp, ast::ExprId),
+}
+
 /// The parser.
-struct Parser {
-    tokens: Vec<Token>,
-    current: usize,
+struct Parser<'a, I> {
+    source: &'a str,
+    tokens: I,
+    peeked: Option<Token>,
+    exprs: ast::ExprPool,
+    symbols: Interner,
 }
 
-impl Parser {
-    fn new(tokens: Vec<Token>) -> Self {
-        Self { tokens, current: 0 }
+impl<'a, I> Parser<'a, I>
+where
+    I: Iterator<Item = Token>,
+{
+    fn new(source: &'a str, tokens: I) -> Self {
+        Self {
+            source,
+            tokens,
+            peeked: None,
+            exprs: ast::ExprPool::new(),
+            symbols: Interner::new(),
+        }
     }
 
     /// Advance the parser and return the next token.
     ///
     /// If the parser has reached the end of the token stream, [`None`] is returned.
     fn advance(&mut self) -> Option<Token> {
-        let token = self.tokens.get(self.current).cloned()?;
-        self.current += 1;
-        Some(token)
+        self.peeked.take().or_else(|| self.tokens.next())
     }
 
     /// Advance the lexer if the pattern matches.
     ///
-    /// This helper macro checks the kind of the token that the lexer is currently pointing to. If the
-    /// kind matches the given pattern, then an [`Ok`] variant containing the peeked token is returned.
-    /// If the pattern did not match, an [`Err`] variant is returned.
+    /// This helper checks the kind of the token that the lexer is currently pointing to. If the
+    /// kind matches the given one, then an [`Ok`] variant containing the peeked token is returned.
+    /// If the kind did not match, an [`Err`] variant is returned. Nothing is allocated or formatted
+    /// on the success path - the expected kind just rides along in the error value and only turns
+    /// into text if the error is reported.
     fn advance_expect(&mut self, kind: TokenKind) -> ParseResult<Token> {
-        let message = format!("expected {kind}");
-
-        let Some(token) = self.peek() else {
-            return Err(ParseError::end_of_file(message));
-        };
-
-        if token.kind != kind {
-            return Err(ParseError::at_token(token.clone(), message));
+        match self.peek_kind() {
+            Some(found) if found == kind => Ok(self.advance().unwrap()),
+            Some(_) => Err(ParseError::at_token(*self.peek().unwrap(), kind)),
+            None => Err(ParseError::end_of_file(kind)),
         }
-
-        Ok(self.advance().unwrap())
     }
 
     /// Get the next token, or an error if there is none.
-    fn advance_expect_anything(&mut self, message: impl Into<String>) -> ParseResult<Token> {
+    fn advance_expect_anything(&mut self, message: &'static str) -> ParseResult<Token> {
         self.advance().ok_or(ParseError::end_of_file(message))
     }
 
     /// Get the token the parser is currently pointing to.
     ///
-    /// If the parser has reached the end of the token stream and is pointing to nothing, a null
-    /// optional is returned.
-    fn peek(&self) -> Option<&Token> {
-        self.tokens.get(self.current)
+    /// The token is pulled out of the underlying stream on first use and held in a one-token
+    /// lookahead slot until `advance` consumes it. If the stream is exhausted and the parser is
+    /// pointing to nothing, a null optional is returned.
+    fn peek(&mut self) -> Option<&Token> {
+        if self.peeked.is_none() {
+            self.peeked = self.tokens.next();
+        }
+
+        self.peeked.as_ref()
     }
 
-    fn peek_expect_anything(&self, message: String) -> ParseResult<&Token> {
+    fn peek_expect_anything(&mut self, message: &'static str) -> ParseResult<&Token> {
         self.peek().ok_or(ParseError::end_of_file(message))
     }
 
+    /// Get the kind of the token the parser is currently pointing to.
+    ///
+    /// Dispatch decisions only ever need the kind, and going through this instead of `peek` keeps
+    /// them from dragging the token's span and position along for the ride.
+    fn peek_kind(&mut self) -> Option<TokenKind> {
+        self.peek().map(|token| token.kind)
+    }
+
     /// Parse a program.
     ///
-    /// This method will parse a program (a single function declaration). After that, it asserts
-    /// that there are no more tokens to be processed. If there are, an exception is thrown.
-    fn parse_program(&mut self) -> ParseResult<ast::Program> {
-        let function = self.parse_function()?;
-        if let Some(token) = self.peek() {
-            Err(ParseError::at_token(token.clone(), "expected end of file"))
-        } else {
-            Ok(ast::Program { function })
+    /// This method parses function declarations until the token stream runs out, so a translation
+    /// unit can define any number of functions. Every function's expressions go into the one
+    /// shared pool.
+    ///
+    /// A failed function does not abort the parse: its error is recorded, the parser skips ahead
+    /// to the next plausible function start, and parsing continues, so one compile reports every
+    /// broken function in the file. A program is only produced if nothing went wrong.
+    fn parse_program(&mut self) -> Result<ast::Program, Vec<ParseError>> {
+        let mut functions = Vec::new();
+        let mut errors = Vec::new();
+
+        while self.peek().is_some() {
+            match self.parse_function() {
+                Ok(function) => functions.push(function),
+                Err(error) => {
+                    errors.push(error);
+                    self.synchronize();
+                }
+            }
+        }
+
+        if !errors.is_empty() {
+            return Err(errors);
+        }
+
+        Ok(ast::Program {
+            functions,
+            exprs: std::mem::take(&mut self.exprs),
+            symbols: std::mem::take(&mut self.symbols),
+        })
+    }
+
+    /// Skip ahead to a point where parsing can plausibly resume after an error.
+    ///
+    /// Tokens are discarded up to and including the next `}` (which ends a function body in this
+    /// grammar) or up to the next `int` (which begins a new definition), whichever comes first.
+    /// Progress is guaranteed: either something is consumed here, or the failed production
+    /// consumed the tokens it matched before erroring.
+    fn synchronize(&mut self) {
+        while let Some(kind) = self.peek_kind() {
+            match kind {
+                TokenKind::DelimBraceRight => {
+                    self.advance();
+                    return;
+                }
+                TokenKind::KeywordInt => return,
+                _ => {
+                    self.advance();
+                }
+            }
         }
     }
 
@@ -173,10 +299,9 @@ impl Parser {
     /// This method looks at the next token in the stream and decides based on that what kind of
     /// statement to parse.
     fn parse_statement(&mut self) -> ParseResult<ast::Statement> {
-        let token = self.peek();
-        match token.map(|t| t.kind) {
+        match self.peek_kind() {
             Some(TokenKind::KeywordReturn) => self.parse_return(),
-            _ => Err(ParseError::new(token.cloned(), "expected statement")),
+            _ => Err(ParseError::new(self.peek().copied(), "expected statement")),
         }
     }
 
@@ -192,106 +317,118 @@ impl Parser {
 
     /// Parse the next expression.
     ///
-    /// This method looks at the next token in the stream and decides based on that what kind of
-    /// expression to parse. In the future, this method may take advantage of Pratt parsing.
-    fn parse_expression(&mut self, prec: Precedence) -> ParseResult<ast::Expr> {
-        let token = self.peek_expect_anything("expected expression".to_string())?;
-        let mut left = self.parse_prefix(token.clone())?;
-
-        while let Some(token) = self.peek()
-            && prec < get_infix_precedence(token.kind)
-        {
-            left = self.parse_infix(token.clone(), left)?;
-        }
-
-        Ok(left)
-    }
-
-    fn parse_prefix(&mut self, token: Token) -> ParseResult<ast::Expr> {
-        match token.kind {
-            TokenKind::DelimParenLeft => self.parse_group(),
-            TokenKind::LiteralIdentifier => todo!(),
-            TokenKind::LiteralInteger => self.parse_integer(),
-            TokenKind::OperatorBang => self.parse_unary(ast::UnaryOp::NegateLogical),
-            TokenKind::OperatorMinus => self.parse_unary(ast::UnaryOp::NegateArith),
-            TokenKind::OperatorTilde => self.parse_unary(ast::UnaryOp::Compliment),
-            _ => Err(ParseError::at_token(token, "expected prefix operator")),
-        }
-    }
-
-    /// Parse an infix expression.
-    ///
-    /// The `kind` is the kind of token that the parser is currently looking at. The `left` is the
-    /// portion of the expression that has been parsed so far, e.g. the left half of the binary
-    /// operation.
-    fn parse_infix(&mut self, token: Token, left: ast::Expr) -> ParseResult<ast::Expr> {
-        match token.kind {
-            TokenKind::OperatorMinus => self.parse_binary(ast::BinaryOp::Minus, left),
-            TokenKind::OperatorPlus => self.parse_binary(ast::BinaryOp::Plus, left),
-            TokenKind::OperatorSlash => self.parse_binary(ast::BinaryOp::Divide, left),
-            TokenKind::OperatorStar => self.parse_binary(ast::BinaryOp::Times, left),
-            TokenKind::OperatorPercent => self.parse_binary(ast::BinaryOp::Mod, left),
-            _ => Err(ParseError::at_token(token, "expected infix operator")),
+    /// This is a Pratt parser run as a single loop over an explicit stack instead of through
+    /// recursion. Every construct that used to suspend a recursive call - a unary operator
+    /// waiting for its operand, an open parenthesis waiting to be closed, a binary operator
+    /// waiting for its right-hand side - becomes a [`Pending`] frame pushed onto the stack along
+    /// with the precedence to restore when it completes. Machine-generated input with tens of
+    /// thousands of nested parentheses or operators therefore grows a heap vector instead of
+    /// blowing the thread stack, and the hot loop sheds the call-frame setup that recursion paid
+    /// per node.
+    fn parse_expression(&mut self, prec: Precedence) -> ParseResult<ast::ExprId> {
+        let mut stack: Vec<(Pending, Precedence)> = Vec::new();
+        let mut min_prec = prec;
+
+        'operand: loop {
+            // Parse prefix constructs until we bottom out at a primary operand. Operators and
+            // parentheses suspend themselves onto the stack rather than recursing.
+            let token = *self.peek_expect_anything("expected expression")?;
+            let mut left = match token.kind {
+                TokenKind::DelimParenLeft => {
+                    self.advance();
+                    stack.push((Pending::Group, min_prec));
+                    min_prec = Precedence::Lowest;
+                    continue 'operand;
+                }
+                TokenKind::OperatorBang => {
+                    self.advance();
+                    stack.push((Pending::Unary(ast::UnaryOp::NegateLogical), min_prec));
+                    min_prec = get_prefix_precedence(token.kind);
+                    continue 'operand;
+                }
+                TokenKind::OperatorMinus => {
+                    self.advance();
+                    stack.push((Pending::Unary(ast::UnaryOp::NegateArith), min_prec));
+                    min_prec = get_prefix_precedence(token.kind);
+                    continue 'operand;
+                }
+                TokenKind::OperatorTilde => {
+                    self.advance();
+                    stack.push((Pending::Unary(ast::UnaryOp::Compliment), min_prec));
+                    min_prec = get_prefix_precedence(token.kind);
+                    continue 'operand;
+                }
+                TokenKind::LiteralIdentifier => todo!(),
+                TokenKind::LiteralInteger => self.parse_integer()?,
+                _ => return Err(ParseError::at_token(token, "expected prefix operator")),
+            };
+
+            // We hold a finished operand. Either the next token is an infix operator binding
+            // tighter than the current precedence floor (shift: suspend the operator and go parse
+            // its right-hand side), or the operand is complete at this level and the deepest
+            // pending frame folds it up (reduce).
+            loop {
+                if let Some(kind) = self.peek_kind()
+                    && min_prec < get_infix_precedence(kind)
+                {
+                    let op = match kind {
+                        TokenKind::OperatorPlus => ast::BinaryOp::Plus,
+                        TokenKind::OperatorMinus => ast::BinaryOp::Minus,
+                        TokenKind::OperatorStar => ast::BinaryOp::Times,
+                        TokenKind::OperatorSlash => ast::BinaryOp::Divide,
+                        TokenKind::OperatorPercent => ast::BinaryOp::Mod,
+                        _ => unreachable!("only operators have an infix precedence"),
+                    };
+
+                    self.advance();
+                    stack.push((Pending::Binary(op, left), min_prec));
+                    min_prec = get_infix_precedence(kind);
+                    continue 'operand;
+                }
+
+                let Some((pending, saved_prec)) = stack.pop() else {
+                    return Ok(left);
+                };
+
+                min_prec = saved_prec;
+                match pending {
+                    Pending::Group => {
+                        self.advance_expect(TokenKind::DelimParenRight)?;
+                    }
+                    Pending::Unary(operator) => {
+                        left = self.exprs.push(ast::Expr::Unary {
+                            operator,
+                            operand: left,
+                        });
+                    }
+                    Pending::Binary(operator, lhs) => {
+                        left = self.exprs.push(ast::Expr::Binary {
+                            operator,
+                            left: lhs,
+                            right: left,
+                        });
+                    }
+                }
+            }
         }
     }
 
-    /// Parse the next unary expression.
-    ///
-    /// This method parses a unary expression with the given operator. The next token is skipped
-    /// (it is assumed to correspond to the operator passed) and an expr3 % (2 + 1ession is parsed. From the
-    /// operator and the parsed expression, a new unary expression is constructed.
-    fn parse_unary(&mut self, op: ast::UnaryOp) -> ParseResult<ast::Expr> {
-        let token = self.advance_expect_anything("expected unary operator")?;
-        let prec = get_prefix_precedence(token.kind);
-        let operand = self.parse_expression(prec)?;
-
-        Ok(ast::Expr::Unary {
-            operator: op,
-            operand: Box::new(operand),
-        })
-    }
-
-    /// Parse the next binary expression.
-    ///
-    /// This method recieves the binary operation that is currently being parsed as well as the
-    /// left hand side of the expression. It assumes that the parser is currently pointing to a
-    /// binary operator token which corresponds to the given `op`.
-    fn parse_binary(&mut self, op: ast::BinaryOp, left: ast::Expr) -> ParseResult<ast::Expr> {
-        let token = self.advance_expect_anything("expected binary operator")?;
-        let prec = get_infix_precedence(token.kind);
-        let right = self.parse_expression(prec)?;
-
-        Ok(ast::Expr::Binary {
-            operator: op,
-            left: Box::new(left),
-            right: Box::new(right),
-        })
-    }
-
-    /// Parse the next group expression.
-    ///
-    /// This method parses an opening parenthesis, followed by an expression with reset precedence,
-    /// and then a closing parenthesis. This has the effect of considering the parenthesized
-    /// expression as a single unit.
-    fn parse_group(&mut self) -> ParseResult<ast::Expr> {
-        self.advance_expect(TokenKind::DelimParenLeft)?;
-        let expr = self.parse_expression(Precedence::Lowest)?;
-        self.advance_expect(TokenKind::DelimParenRight)?;
-        Ok(expr)
-    }
-
-    /// Parse the next identifier.
+    /// Parse the next identifier, interning it into the program's symbol table.
     ///
-    /// This method expects an identifier token.
-    fn parse_identifier(&mut self) -> ParseResult<String> {
+    /// This method expects an identifier token. The first occurrence of a name pays one hash
+    /// lookup and one allocation; every repeat is just the lookup, and everything downstream
+    /// compares the returned symbols as integers.
+    fn parse_identifier(&mut self) -> ParseResult<Symbol> {
         let ident = self.advance_expect(TokenKind::LiteralIdentifier)?;
-        Ok(ident.lexeme.clone())
+        Ok(self.symbols.intern(ident.lexeme(self.source)))
     }
 
     /// Parse the next integer literal.
-    fn parse_integer(&mut self) -> ParseResult<ast::Expr> {
+    ///
+    /// The lexer already computed the literal's value into the token's payload, so this is just a
+    /// field read - no trip back through the source text.
+    fn parse_integer(&mut self) -> ParseResult<ast::ExprId> {
         let integer = self.advance_expect(TokenKind::LiteralInteger)?;
-        let value: i32 = integer.lexeme.parse().unwrap();
-        Ok(ast::Expr::Integer(value))
+        Ok(self.exprs.push(ast::Expr::Integer(integer.value)))
     }
 }
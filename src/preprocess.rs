@@ -0,0 +1,209 @@
+//! `#include` handling with a process-wide header cache.
+//!
+//! The build feeds ecc the same shared headers in every translation unit, which used to mean
+//! pre-expanding includes externally and re-lexing identical header bytes over and over. This
+//! module expands `#include "name"` directives itself and keeps each header's lexed
+//! [`TokenStream`] in a cache that lives for the whole process: the first inclusion reads and
+//! lexes the header once, and every later inclusion - across the files of a batch run, or across
+//! requests to a resident daemon - splices the cached token stream into the including file with
+//! [`TokenStream::append_shifted`], the same bulk rebase the parallel lexer uses for its chunks.
+//!
+//! The expanded source text is still assembled alongside the tokens, because diagnostics render
+//! by slicing token spans out of one contiguous source. Appending the cached header text is a
+//! memcpy; only the lexing is skipped, and that is where the front-end time goes.
+//!
+//! Only the quoted form is recognized, resolved relative to the including file's directory, and
+//! headers may include other headers; inclusion cycles are reported rather than followed. Line
+//! numbers in diagnostics refer to the expanded translation unit, exactly as they would when
+//! compiling the externally pre-expanded file.
+
+use std::collections::HashMap;
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, LazyLock, Mutex};
+
+use crate::CompileError;
+use crate::lexer;
+use crate::token::TokenStream;
+
+/// A header lexed once and kept for splicing.
+///
+/// The cached stream's positions are relative to the header's own start; splicing rebases them.
+/// Nested includes are already expanded here, so a cache hit costs no directive scanning at all.
+struct CachedHeader {
+    source: String,
+    stream: TokenStream,
+    lines: u32,
+}
+
+/// The process-wide header cache, keyed by canonical path.
+///
+/// Living in a static rather than being threaded through the pipeline is the point: the daemon
+/// and multi-file batch runs share one cache without any caller cooperation. Entries are never
+/// invalidated; a header edited under a running daemon needs a daemon restart, the same contract
+/// the object cache has with its hash salt.
+static HEADER_CACHE: LazyLock<Mutex<HashMap<PathBuf, Arc<CachedHeader>>>> =
+    LazyLock::new(|| Mutex::new(HashMap::new()));
+
+/// A translation unit with its includes expanded.
+pub struct Preprocessed {
+    /// The expanded source text, with each directive line replaced by its header's text.
+    pub source: String,
+
+    /// The token stream of the expanded source, positions rebased into `source`.
+    pub stream: TokenStream,
+
+    /// How many newlines `source` holds so far; splices use this as their line base.
+    lines: u32,
+}
+
+/// Expand the includes of one translation unit.
+///
+/// `directory` is where quoted include paths are resolved from, normally the directory of the
+/// file being compiled. Sources without a `#` anywhere skip this entirely (the caller checks),
+/// so include-free files keep the streaming lexer-to-parser path.
+pub fn preprocess(source: &str, directory: &Path) -> Result<Preprocessed, CompileError> {
+    let mut out = Preprocessed {
+        source: String::new(),
+        stream: TokenStream::new(),
+        lines: 0,
+    };
+
+    let mut stack = Vec::new();
+    expand(source, directory, &mut out, &mut stack)?;
+
+    Ok(out)
+}
+
+/// Expand one source body into `out`, recursing through its includes.
+///
+/// The text between directives is spliced in segments that always start at a line boundary, so
+/// the rebased line and column numbers stay exact.
+fn expand(
+    source: &str,
+    directory: &Path,
+    out: &mut Preprocessed,
+    stack: &mut Vec<PathBuf>,
+) -> Result<(), CompileError> {
+    let mut segment_start = 0;
+    let mut line_start = 0;
+
+    while line_start < source.len() {
+        let line_end = match memchr::memchr(b'\n', &source.as_bytes()[line_start..]) {
+            Some(i) => line_start + i + 1,
+            None => source.len(),
+        };
+
+        let line = &source[line_start..line_end];
+        if line.trim_start().starts_with('#') {
+            splice_text(out, &source[segment_start..line_start]);
+            splice_header(parse_include(line)?, directory, out, stack)?;
+            segment_start = line_end;
+        }
+
+        line_start = line_end;
+    }
+
+    splice_text(out, &source[segment_start..]);
+
+    Ok(())
+}
+
+/// Pull the quoted header name out of a directive line.
+fn parse_include(line: &str) -> Result<&str, CompileError> {
+    let malformed = || CompileError::Preprocess(format!("malformed directive: {}", line.trim()));
+
+    let rest = line.trim().strip_prefix('#').unwrap().trim_start();
+    let rest = rest.strip_prefix("include").ok_or_else(malformed)?.trim();
+
+    if rest.starts_with('<') {
+        return Err(CompileError::Preprocess(format!(
+            "system headers are not supported: {}",
+            line.trim()
+        )));
+    }
+
+    rest.strip_prefix('"')
+        .and_then(|r| r.strip_suffix('"'))
+        .ok_or_else(malformed)
+}
+
+/// Splice a run of plain source text into the output, lexing it.
+fn splice_text(out: &mut Preprocessed, text: &str) {
+    if text.is_empty() {
+        return;
+    }
+
+    let stream = lexer::tokenize_stream(text);
+    out.stream
+        .append_shifted(&stream, out.source.len() as u32, out.lines);
+    out.source.push_str(text);
+    out.lines += memchr::memchr_iter(b'\n', text.as_bytes()).count() as u32;
+}
+
+/// Splice a header into the output, lexing it only if the cache has never seen it.
+fn splice_header(
+    name: &str,
+    directory: &Path,
+    out: &mut Preprocessed,
+    stack: &mut Vec<PathBuf>,
+) -> Result<(), CompileError> {
+    let path = directory.join(name);
+    let path = path.canonicalize().map_err(CompileError::Io)?;
+
+    if stack.contains(&path) {
+        return Err(CompileError::Preprocess(format!(
+            "inclusion cycle through {}",
+            path.display()
+        )));
+    }
+
+    let cached = HEADER_CACHE.lock().unwrap().get(&path).cloned();
+    let header = match cached {
+        Some(header) => header,
+        None => {
+            let header = Arc::new(load_header(&path, stack)?);
+            HEADER_CACHE
+                .lock()
+                .unwrap()
+                .insert(path.clone(), header.clone());
+            header
+        }
+    };
+
+    out.stream
+        .append_shifted(&header.stream, out.source.len() as u32, out.lines);
+    out.source.push_str(&header.source);
+    out.lines += header.lines;
+
+    Ok(())
+}
+
+/// Read, expand, and lex a header for the first time.
+fn load_header(path: &Path, stack: &mut Vec<PathBuf>) -> Result<CachedHeader, CompileError> {
+    let text = std::fs::read_to_string(path)?;
+
+    // Expanding into a fresh buffer keeps the cached positions header-relative. The text is
+    // padded to end on a line boundary so whatever is spliced after it starts a fresh line.
+    let mut expanded = Preprocessed {
+        source: String::new(),
+        stream: TokenStream::new(),
+        lines: 0,
+    };
+
+    stack.push(path.to_path_buf());
+    let directory = path.parent().unwrap_or(Path::new("."));
+    let result = expand(&text, directory, &mut expanded, stack);
+    stack.pop();
+    result?;
+
+    if !expanded.source.ends_with('\n') && !expanded.source.is_empty() {
+        expanded.source.push('\n');
+        expanded.lines += 1;
+    }
+
+    Ok(CachedHeader {
+        source: expanded.source,
+        stream: expanded.stream,
+        lines: expanded.lines,
+    })
+}
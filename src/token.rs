@@ -63,11 +63,16 @@ impl std::fmt::Display for TokenKind {
 ///
 /// If the lexeme is a keyword, the returned token type will indicate which one it is. Otherwise,
 /// the returned token type is [`TokenKind::LiteralIdentifier`].
-pub fn check_keyword(lexeme: &str) -> TokenKind {
-    match lexeme {
-        "int" => TokenKind::KeywordInt,
-        "return" => TokenKind::KeywordReturn,
-        "void" => TokenKind::KeywordVoid,
+///
+/// The match works directly on the identifier's bytes, dispatching on length and first byte
+/// before doing a single full comparison. Most identifiers bail out on the length alone, so the
+/// cost per identifier stays flat no matter how many keywords end up in this table as language
+/// coverage grows - there is never a chain of string comparisons to fall through.
+pub fn check_keyword(lexeme: &[u8]) -> TokenKind {
+    match (lexeme.len(), lexeme[0]) {
+        (3, b'i') if lexeme == b"int" => TokenKind::KeywordInt,
+        (4, b'v') if lexeme == b"void" => TokenKind::KeywordVoid,
+        (6, b'r') if lexeme == b"return" => TokenKind::KeywordReturn,
         _ => TokenKind::LiteralIdentifier,
     }
 }
@@ -75,19 +80,135 @@ pub fn check_keyword(lexeme: &str) -> TokenKind {
 /// A source code token.
 ///
 /// Tokens are the smallest unit of lexical information. They are analogous to words in spoken
-/// language. A token contains its kind, the corresponding substring of the source code (the
-/// lexeme), and the line and column info.
-#[derive(Clone, Debug)]
+/// language. A token contains its kind, a span (byte offset and length) pointing back into the
+/// source code, and the line and column info. The lexeme itself is not stored; keeping only a span
+/// means making a token never touches the heap, which matters a lot when a big file produces
+/// millions of them. When the text is actually needed (pretty much only when reporting an error),
+/// use [`Token::lexeme`] to borrow it back out of the source.
+#[derive(Clone, Copy, Debug)]
 pub struct Token {
     /// The kind of token this is. This information is helpful for the parser.
     pub kind: TokenKind,
 
-    /// The corresponding string in the source code from which this token came.
-    pub lexeme: String,
+    /// The byte offset into the source code at which this token starts.
+    pub offset: u32,
+
+    /// The length of this token's lexeme in bytes.
+    pub length: u32,
 
     /// The line of the source code that this token was on.
-    pub line: usize,
+    pub line: u32,
 
     /// The column of the source code that this token was on.
-    pub column: usize,
+    pub column: u32,
+
+    /// The token's payload: for [`TokenKind::LiteralInteger`] this is the literal's value,
+    /// computed by the lexer while its bytes were already hot in cache. Everything downstream
+    /// reads the number from here instead of re-parsing the lexeme text. Zero for other kinds.
+    pub value: i32,
+}
+
+impl Token {
+    /// Borrow this token's lexeme back out of the source code it was lexed from.
+    ///
+    /// This will panic (or return garbage) if `source` is not the same string that produced the
+    /// token, since the stored span is only meaningful relative to that string.
+    pub fn lexeme<'a>(&self, source: &'a str) -> &'a str {
+        &source[self.offset as usize..(self.offset + self.length) as usize]
+    }
+}
+
+/// A buffered token sequence stored as parallel arrays.
+///
+/// The parser normally streams tokens straight out of the lexer and never buffers them, but when
+/// a whole token sequence does need to be held in memory, this layout beats a `Vec<Token>`: the
+/// kinds sit in their own dense array at one byte per token, so a pass that only dispatches on
+/// kind (which is almost all of them) pulls an order of magnitude fewer bytes through the cache,
+/// while spans and positions live in side arrays that are only touched when a token's text or
+/// location is actually wanted.
+#[derive(Clone, Debug, Default)]
+pub struct TokenStream {
+    kinds: Vec<TokenKind>,
+    offsets: Vec<u32>,
+    lengths: Vec<u32>,
+    lines: Vec<u32>,
+    columns: Vec<u32>,
+    values: Vec<i32>,
+}
+
+impl TokenStream {
+    /// Create an empty token stream.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// The number of tokens in the stream.
+    pub fn len(&self) -> usize {
+        self.kinds.len()
+    }
+
+    /// Return true if the stream holds no tokens.
+    pub fn is_empty(&self) -> bool {
+        self.kinds.is_empty()
+    }
+
+    /// Append a token to the stream.
+    pub fn push(&mut self, token: Token) {
+        self.kinds.push(token.kind);
+        self.offsets.push(token.offset);
+        self.lengths.push(token.length);
+        self.lines.push(token.line);
+        self.columns.push(token.column);
+        self.values.push(token.value);
+    }
+
+    /// The dense array of token kinds, one byte per token.
+    pub fn kinds(&self) -> &[TokenKind] {
+        &self.kinds
+    }
+
+    /// Reassemble the token at the given index from the parallel arrays.
+    pub fn get(&self, index: usize) -> Token {
+        Token {
+            kind: self.kinds[index],
+            offset: self.offsets[index],
+            length: self.lengths[index],
+            line: self.lines[index],
+            column: self.columns[index],
+            value: self.values[index],
+        }
+    }
+
+    /// Iterate over the tokens in the stream.
+    pub fn iter(&self) -> impl Iterator<Item = Token> + '_ {
+        (0..self.len()).map(|index| self.get(index))
+    }
+
+    /// Append every token of `other`, shifting positions by the given byte and line offsets.
+    ///
+    /// This is the stitching step of the parallel tokenizer: each chunk is lexed with coordinates
+    /// relative to its own start, and this rebases them into whole-file coordinates. Columns need
+    /// no adjustment because chunks always begin at the start of a line. Working array-by-array
+    /// keeps the copy as a handful of bulk extends instead of a per-token gather.
+    pub fn append_shifted(&mut self, other: &Self, byte_offset: u32, line_offset: u32) {
+        self.kinds.extend_from_slice(&other.kinds);
+        self.offsets
+            .extend(other.offsets.iter().map(|offset| offset + byte_offset));
+        self.lengths.extend_from_slice(&other.lengths);
+        self.lines
+            .extend(other.lines.iter().map(|line| line + line_offset));
+        self.columns.extend_from_slice(&other.columns);
+        self.values.extend_from_slice(&other.values);
+    }
+}
+
+impl FromIterator<Token> for TokenStream {
+    fn from_iter<T: IntoIterator<Item = Token>>(tokens: T) -> Self {
+        let mut stream = Self::new();
+        for token in tokens {
+            stream.push(token);
+        }
+
+        stream
+    }
 }